@@ -0,0 +1,93 @@
+#pragma once
+#include <cstddef>
+#include <hypergrep/io_concurrency.hpp>
+#include <hypergrep/resource_governor.hpp>
+#include <memory>
+#include <optional>
+#include <string_view>
+
+// Reads a file in chunks that end at a line boundary
+//
+// A chunk stops before the last newline read so far. The rest (the start
+// of a line) stays in the buffer and the next read appends to it, so
+// nothing is read twice and there is no need to lseek back. The buffer is
+// compacted only when there isn't room for another FILE_CHUNK_SIZE read.
+//
+// A line of FILE_CHUNK_SIZE bytes or more isn't buffered whole. It is
+// handed out in pieces instead, so the buffer never grows.
+//
+// With `bypass_cache` (--no-cache), files are read with O_DIRECT, into a
+// buffer kept aligned for it. If the filesystem doesn't support that, the
+// pages read are dropped from the page cache instead.
+//
+// Each read is paced by the `governor`, if any, and holds a slot of the
+// file's device class in `device_limits`, if any.
+class chunk_reader {
+public:
+  enum class status { chunk, line_piece, end_of_file };
+
+  explicit chunk_reader(bool bypass_cache = false,
+                        resource_governor *governor = nullptr,
+                        io_concurrency *device_limits = nullptr);
+
+  chunk_reader(const chunk_reader &) = delete;
+  chunk_reader &operator=(const chunk_reader &) = delete;
+
+  // Start reading a newly opened file (or pipe)
+  // `first_read` is the start of the file, if it was read already
+  // (at most FILE_CHUNK_SIZE bytes). With the `file_size` from a stat, the
+  // file ends once that much is read, without another read to find out.
+  // Files that claim to be empty (e.g., in /proc) are read to the end.
+  // `io_class` is the class of the device the file is on.
+  void reset(int fd, std::string_view first_read = {},
+             std::optional<std::size_t> file_size = {},
+             device_class io_class = device_class::local);
+
+  // Returns a chunk of whole lines, or a piece of a long line
+  // The chunk is valid until the next call to next() or reset().
+  // Stops at end of file and on read errors.
+  status next(std::string_view &chunk);
+
+  // True once the most recent chunk was the last one
+  bool done() const { return at_end_of_file && begin == end; }
+
+  // File offset of the most recent chunk
+  std::size_t chunk_offset() const { return offset; }
+
+private:
+  status take(std::size_t chunk_end, status kind, std::string_view &chunk);
+
+  void start_direct_io();
+  void stop_direct_io();
+
+private:
+  std::unique_ptr<char[]> storage{};
+  // Aligned for O_DIRECT
+  char *buffer{nullptr};
+  int fd{-1};
+
+  // Bytes not yet returned in a chunk are [begin, end) of the buffer,
+  // found at `unscanned_offset` in the file
+  std::size_t begin{0};
+  std::size_t end{0};
+  std::size_t unscanned_offset{0};
+  std::size_t offset{0};
+  std::size_t total_bytes_read{0};
+  // Zero if unknown
+  std::size_t expected_size{0};
+
+  // In a file, a short read ends the file, there is no need to read again.
+  // A pipe ends with a read of zero bytes.
+  bool at_end_of_file{false};
+  bool is_pipe{false};
+
+  // Set while the pieces of a long line are handed out
+  bool in_long_line{false};
+
+  bool bypass_cache{false};
+  bool direct_io{false};
+
+  resource_governor *governor{nullptr};
+  io_concurrency *device_limits{nullptr};
+  device_class io_class{device_class::local};
+};
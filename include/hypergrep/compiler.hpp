@@ -6,6 +6,9 @@
 
 struct search_options;
 
+// `mode` is HS_MODE_BLOCK or HS_MODE_STREAM. The scratch space may be
+// allocated already, e.g., for the block mode database of the same patterns.
 void compile_hs_database(hs_database **database, hs_scratch **scratch,
-                         search_options &options,
-                         const std::vector<std::string> &pattern_list);
\ No newline at end of file
+                         const search_options &options,
+                         const std::vector<std::string> &pattern_list,
+                         unsigned int mode = HS_MODE_BLOCK);
\ No newline at end of file
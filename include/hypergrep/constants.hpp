@@ -8,6 +8,19 @@ constexpr static inline std::string_view VERSION = "0.1.1";
 constexpr static inline std::size_t TYPICAL_FILESYSTEM_BLOCK_SIZE = 4096;
 constexpr static inline std::size_t FILE_CHUNK_SIZE =
     16 * TYPICAL_FILESYSTEM_BLOCK_SIZE;
+constexpr static inline std::size_t CHUNK_READER_BUFFER_SIZE =
+    4 * FILE_CHUNK_SIZE;
+constexpr static inline std::size_t DIRECTORY_BUFFER_SIZE =
+    8 * TYPICAL_FILESYSTEM_BLOCK_SIZE;
 constexpr static inline std::size_t LARGE_FILE_SIZE = 1024 * 1024;
+constexpr static inline std::size_t MAX_LARGE_FILE_CLAIM_SIZE =
+    16 * FILE_CHUNK_SIZE;
+constexpr static inline std::size_t LARGE_FILE_WINDOW_SIZE =
+    64 * 1024 * 1024;
+constexpr static inline std::size_t LARGE_FILE_READ_AHEAD_SIZE =
+    8 * 1024 * 1024;
+constexpr static inline std::size_t TINY_FILE_SIZE =
+    TYPICAL_FILESYSTEM_BLOCK_SIZE;
+constexpr static inline std::size_t FILE_BATCH_SIZE = FILE_CHUNK_SIZE;
 constexpr static inline std::size_t MAX_LINE_LENGTH = 4096;
 constexpr static inline std::string_view WHITESPACE = " \t";
@@ -0,0 +1,37 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <dirent.h>
+
+struct directory_entry {
+  const char *name{nullptr};
+  unsigned char type{DT_UNKNOWN};
+  std::uint64_t inode{0};
+};
+
+// Reads the entries of an open directory in large batches using getdents64
+//
+// The name of an entry points into the caller's buffer and is only valid
+// until the next call to next()
+class directory_reader {
+public:
+  directory_reader(int fd, char *buffer, std::size_t buffer_size);
+
+  // Returns false once the directory is exhausted or cannot be read
+  bool next(directory_entry &entry);
+
+private:
+  int fd{-1};
+  char *buffer{nullptr};
+  std::size_t buffer_size{0};
+  std::size_t bytes_in_buffer{0};
+  std::size_t offset{0};
+};
+
+// Resolve DT_UNKNOWN (some filesystems, e.g., XFS v4 or NFS, don't fill
+// in d_type) with an fstatat relative to the directory
+//
+// With `follow_symlinks`, the type of a symlink's target is returned
+// instead, or DT_UNKNOWN if the symlink is dangling
+unsigned char resolve_entry_type(int dirfd, const char *name,
+                                 bool follow_symlinks = false);
@@ -11,18 +11,32 @@
 #include <fstream>
 #include <git2.h>
 #include <hs/hs.h>
+#include <hypergrep/chunk_reader.hpp>
 #include <hypergrep/compiler.hpp>
 #include <hypergrep/constants.hpp>
+#include <hypergrep/directory_reader.hpp>
+#include <hypergrep/file_extent.hpp>
+#include <hypergrep/file_batch.hpp>
 #include <hypergrep/file_filter.hpp>
 #include <hypergrep/file_search.hpp>
 #include <hypergrep/git_index_search.hpp>
+#include <hypergrep/ignore_rules.hpp>
+#include <hypergrep/inode_set.hpp>
 #include <hypergrep/is_binary.hpp>
+#include <hypergrep/listing_cache.hpp>
 #include <hypergrep/match_handler.hpp>
+#include <hypergrep/path_arena.hpp>
 #include <hypergrep/search_options.hpp>
 #include <hypergrep/size_to_bytes.hpp>
+#include <hypergrep/streaming_database.hpp>
+#include <hypergrep/task_scheduler.hpp>
 #include <limits>
+#include <memory>
+#include <mutex>
 #include <numeric>
+#include <optional>
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <thread>
 #include <unistd.h>
@@ -35,34 +49,128 @@ public:
   ~directory_search();
   void run(std::filesystem::path path);
 
+  // Search the paths read from `fd` (--files-from), without any traversal
+  void run_file_list(int fd);
+
 private:
-  bool process_file(std::string &&filename, hs_scratch_t *local_scratch,
-                    char *buffer, std::string &lines);
+  void finish_search();
+
+  struct worker_state;
+
+  // Search a file, unless it is tiny and there is a `batch` to add it to
+  // Returns true if it was added. Its directory is then released by
+  // search_batch, instead of by the caller.
+  bool process_file(const file_node *file, worker_state &state,
+                    file_batch *batch);
+
+  // Search an open file, or a file read whole into `first_read` (fd -1)
+  bool search_file(const file_node *file, int fd, std::string_view first_read,
+                   const struct stat &file_stat, worker_state &state);
+
+  // Scan the tiny files of the worker's batch, search the ones with
+  // a match and release their directories
+  void search_batch(worker_state &state);
+
+  void enqueue_directory(directory_node *directory);
+
+  void enqueue_file(file_node *file);
+
+  // Files of one directory, searched in a single task
+  void enqueue_files(std::vector<file_node *> &&files);
+
+  void enqueue_listed_file(file_node *file);
+
+  bool filter_listed_file(const file_node *file, std::size_t worker_index);
+
+  void release_directory(directory_node *directory);
+
+  void finish_directory_visit();
+
+  void enqueue_ordered_files(directory_node *directory,
+                             std::size_t worker_index);
+
+  bool cut_ordered_batch(bool force);
+
+  void start_ordered_readers();
 
-  bool try_dequeue_and_process_path(moodycamel::ConsumerToken &ctok,
-                                    hs_scratch_t *local_scratch, char *buffer,
-                                    std::string &lines);
+  void read_ordered_files(std::size_t worker_index);
 
-  void search_thread_function();
+  // `directory_stat` is only needed with --listing-cache, and
+  // `cached_entries` is the listing to use instead of reading the directory
+  void visit_directory_and_enqueue(
+      directory_node *directory, std::size_t worker_index,
+      const struct stat *directory_stat = nullptr,
+      std::optional<std::string_view> cached_entries = std::nullopt);
 
-  void visit_directory_and_enqueue(moodycamel::ProducerToken &ptok,
-                                   std::string directory,
-                                   hs_scratch *local_file_filter_scratch);
+  void visit_git_repo(directory_node *directory, std::size_t worker_index);
+
+  void print_files(directory_node *directory, std::size_t worker_index);
+
+  bool prune_directory(directory_node *parent, const char *name,
+                       std::size_t worker_index);
+
+  void apply_ignore_rules(directory_node *directory,
+                          std::uint32_t ignore_files,
+                          std::size_t worker_index);
 
 private:
   std::filesystem::path search_path;
 
-  // Directory traversal
-  moodycamel::ConcurrentQueue<std::string> subdirectories;
-  std::atomic<std::size_t> num_dirs_enqueued{0};
+  // Directories, files, nested git repos and large file chunks
+  // are all tasks on this scheduler
+  std::unique_ptr<task_scheduler> scheduler;
+
+  // A file waiting to be read with --sort-files
+  struct ordered_file {
+    std::uint64_t key;
+    file_node *file;
+  };
+
+  // Scratch space and buffers owned by each scheduler worker
+  struct worker_state {
+    hs_scratch_t *scratch{nullptr};
+    hs_scratch_t *file_filter_scratch{nullptr};
+    hs_scratch_t *directory_filter_scratch{nullptr};
+    hs_scratch_t *ignore_scratch{nullptr};
+    hs_scratch_t *file_type_scratch{nullptr};
+    hs_scratch_t *glob_scratch{nullptr};
+    std::unique_ptr<chunk_stream> stream{};
+    std::unique_ptr<chunk_reader> reader{};
+    // Tiny files read but not yet scanned, see file_batch
+    std::unique_ptr<file_batch> batch{};
+    std::vector<const file_node *> batched_files{};
+    std::string lines{};
+    std::unique_ptr<char[]> directory_buffer{};
+    path_arena arena{};
 
-  moodycamel::ConcurrentQueue<std::string> queue;
+    // Reused for every directory listing: names back to back, each NUL
+    // terminated and followed by its inode number (see append_name),
+    // with the offsets of the subdirectories and files
+    std::string names{};
+    std::vector<std::uint32_t> subdirectory_offsets{};
+    std::vector<std::uint32_t> file_offsets{};
+    std::vector<file_node *> file_nodes{};
+    std::vector<ordered_file> ordered_files{};
+    // Raw entries of the directory being read, for --listing-cache
+    std::string listing{};
+    std::string path{};
+    std::string filename{};
+
+    // Rules of the ignore files found by this worker,
+    // kept until the end of the search
+    std::vector<std::unique_ptr<ignore_rules>> loaded_ignore_rules{};
+  };
+  std::vector<worker_state> worker_states;
 
-  std::atomic<bool> running{true};
-  std::atomic<std::size_t> num_files_enqueued{0};
-  std::atomic<std::size_t> num_files_dequeued{0};
+  // Directory fds are kept open while their entries are pending, up to a
+  // limit derived from RLIMIT_NOFILE. Past that, entries fall back to
+  // being opened by full path.
+  std::atomic<std::size_t> num_retained_fds{0};
+  std::size_t max_retained_fds{0};
 
   hs_database_t *database = NULL;
+  // Streaming mode, for files read in chunks
+  streaming_database *stream_database = NULL;
   hs_scratch_t *scratch = NULL;
   hs_database_t *file_filter_database = NULL;
   hs_scratch_t *file_filter_scratch = NULL;
@@ -70,17 +178,42 @@ private:
   // then negate the result of the filter
   bool negate_filter{false};
 
+  // Compiled --exclude-dir patterns
+  hs_database_t *directory_filter_database = NULL;
+  hs_scratch_t *directory_filter_scratch = NULL;
+
+  // Length of the search root path, including the trailing '/'
+  std::size_t root_path_length{0};
+
+  // Directories and files already visited, with -L/--follow
+  // or --report-aliases
+  std::unique_ptr<inode_set> visited_directories;
+  std::unique_ptr<inode_set> visited_files;
+
+  // Listings of unchanged directories from earlier runs,
+  // with --listing-cache
+  std::unique_ptr<listing_cache> cached_listings;
+
+  // Device of the search root, for --one-file-system
+  dev_t root_device{0};
+
   search_options options;
 
-  // Optimizations for large files
-  struct large_file {
-    std::string path;
-    std::size_t size;
-  };
-  moodycamel::ConcurrentQueue<large_file> large_file_backlog;
-  std::atomic<std::size_t> num_large_files_enqueued{0};
+  // --sort-files: instead of one task per file, files are gathered in a
+  // batch, sorted by inode or physical offset, and read in that order by
+  // at most MAX_ORDERED_READERS tasks
+  static constexpr std::size_t MAX_ORDERED_READERS = 2;
+  std::mutex ordered_mutex;
+  std::vector<ordered_file> ordered_batch{};
+  std::vector<ordered_file> ordered_queue{};
+  std::size_t ordered_queue_position{0};
+  std::size_t num_ordered_readers{0};
+
+  // Directories enqueued but not visited yet. The batch size grows with
+  // this, and the last batch is cut once it drops to zero.
+  std::atomic<std::size_t> num_directories_pending{0};
 
-  // Optimizations for git repos
-  moodycamel::ConcurrentQueue<std::string> git_repo_paths;
-  std::atomic<std::size_t> num_git_repos_enqueued{0};
+  // Large files are memory mapped and searched in chunks
+  // on the same scheduler
+  std::unique_ptr<file_search> large_file_searcher;
 };
@@ -0,0 +1,74 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <hs/hs.h>
+#include <hypergrep/constants.hpp>
+#include <hypergrep/io_concurrency.hpp>
+#include <hypergrep/resource_governor.hpp>
+#include <memory>
+#include <string_view>
+#include <sys/stat.h>
+#include <vector>
+
+// Tiny files, read whole and scanned together with a single hs_scan
+//
+// The files are packed into one buffer, each followed by a newline, and a
+// match is charged to the file it ends in. A match may also start in an
+// earlier file or end in a separator, so a file with a match is searched
+// again on its own for the exact matches. Most files have none, and cost
+// only their share of the one scan.
+//
+// A pattern anchored to the start or end of the data can't match in the
+// middle of a batch, see search_options::batch_tiny_files.
+class file_batch {
+public:
+  // `file` is whatever the caller uses to find the file again
+  using on_match_fn = std::function<void(
+      const void *file, const struct stat &file_stat, std::string_view data)>;
+
+  // With `drop_cache` (--no-cache), each file read is dropped from the
+  // page cache. Reads are paced by the `governor`, if any, and hold a slot
+  // of the file's device class in `device_limits`, if any.
+  explicit file_batch(bool drop_cache = false,
+                      resource_governor *governor = nullptr,
+                      io_concurrency *device_limits = nullptr);
+
+  file_batch(const file_batch &) = delete;
+  file_batch &operator=(const file_batch &) = delete;
+
+  bool empty() const { return files.empty(); }
+
+  bool has_room(std::size_t size) const {
+    return used + size + 1 <= FILE_BATCH_SIZE;
+  }
+
+  // Read all of an open file, at most TINY_FILE_SIZE bytes, into the batch
+  // Returns false if the file couldn't be read whole. A binary file is
+  // read but left out.
+  bool read_file(int fd, const void *file, const struct stat &file_stat);
+
+  // Scan the batch and call `on_match` for each file with a match, in the
+  // order the files were added. The batch is empty afterwards.
+  void scan(hs_database_t *database, hs_scratch_t *scratch,
+            const on_match_fn &on_match);
+
+private:
+  static int on_batch_match(unsigned int id, unsigned long long from,
+                            unsigned long long to, unsigned int flags,
+                            void *ctx);
+
+private:
+  struct batched_file {
+    const void *file{nullptr};
+    struct stat file_stat{};
+    std::size_t offset{0};
+    bool matched{false};
+  };
+
+  std::unique_ptr<char[]> buffer{};
+  std::size_t used{0};
+  std::vector<batched_file> files{};
+  bool drop_cache{false};
+  resource_governor *governor{nullptr};
+  io_concurrency *device_limits{nullptr};
+};
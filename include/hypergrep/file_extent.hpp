@@ -0,0 +1,10 @@
+#pragma once
+#include <cstdint>
+
+// Physical offset of the first extent of a file, using the FIEMAP ioctl
+//
+// `name` is opened relative to `dirfd` (which may be AT_FDCWD). Returns
+// false if the file can't be opened, the filesystem doesn't support
+// FIEMAP, or the file has no extent yet (e.g., it's empty or inline).
+bool first_physical_offset(int dirfd, const char *name,
+                           std::uint64_t &offset);
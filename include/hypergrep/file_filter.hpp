@@ -2,7 +2,10 @@
 #include <cstdio>
 #include <cstring>
 #include <hs/hs.h>
-#include <hypergrep/search_options.hpp>
+#include <string>
+#include <vector>
+
+struct search_options;
 
 struct filter_context {
   bool result{false};
@@ -15,6 +18,51 @@ bool construct_file_filtering_hs_database(hs_database **file_filter_database,
 int on_file_filter_match(unsigned int id, unsigned long long from,
                          unsigned long long to, unsigned int flags, void *ctx);
 
-bool filter_file(const char *path, hs_database *file_filter_database,
+bool filter_file(const char *path, std::size_t length,
+                 hs_database *file_filter_database,
                  hs_scratch *local_file_filter_scratch,
-                 const bool &negate_filter);
\ No newline at end of file
+                 const bool &negate_filter);
+
+bool construct_directory_filtering_hs_database(
+    hs_database **directory_filter_database,
+    hs_scratch **directory_filter_scratch, const search_options &options);
+
+// Returns true if the directory matches any of the --exclude-dir patterns
+// and should not be traversed
+bool exclude_directory(const char *path, std::size_t length,
+                       hs_database *directory_filter_database,
+                       hs_scratch *local_directory_filter_scratch);
+
+// Repeated --glob and --iglob patterns, compiled into one database
+//
+// Globs are matched against the path relative to the search root. A glob
+// matches a file or any of its parent directories, and a glob starting
+// with '!' excludes what it matches. Each glob's pattern ID is its
+// position on the command line (--iglob after --glob), so the last
+// matching glob wins. If no glob matches, the file is searched only when
+// every glob is an exclusion.
+class glob_filter {
+public:
+  // Throws std::runtime_error if a glob doesn't compile
+  glob_filter(const std::vector<std::string> &globs,
+              const std::vector<std::string> &case_insensitive_globs);
+  ~glob_filter();
+
+  glob_filter(const glob_filter &) = delete;
+  glob_filter &operator=(const glob_filter &) = delete;
+
+  bool alloc_scratch(hs_scratch **scratch) const;
+
+  // Returns true if the file should be searched
+  bool accept(const char *path, std::size_t length,
+              hs_scratch *local_glob_scratch) const;
+
+private:
+  static int on_match(unsigned int id, unsigned long long from,
+                      unsigned long long to, unsigned int flags, void *ctx);
+
+private:
+  hs_database *database{nullptr};
+  std::vector<bool> negated{};
+  bool has_include_globs{false};
+};
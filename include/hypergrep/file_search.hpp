@@ -2,7 +2,6 @@
 #include <argparse/argparse.hpp>
 #include <atomic>
 #include <chrono>
-#include <concurrentqueue/concurrentqueue.h>
 #include <fcntl.h>
 #include <filesystem>
 #include <fmt/color.h>
@@ -10,39 +9,66 @@
 #include <fstream>
 #include <git2.h>
 #include <hs/hs.h>
+#include <hypergrep/chunk_reader.hpp>
 #include <hypergrep/compiler.hpp>
 #include <hypergrep/constants.hpp>
 #include <hypergrep/is_binary.hpp>
 #include <hypergrep/match_handler.hpp>
+#include <hypergrep/reorder_buffer.hpp>
 #include <hypergrep/search_options.hpp>
+#include <hypergrep/streaming_database.hpp>
+#include <hypergrep/task_scheduler.hpp>
 #include <limits>
 #include <numeric>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <thread>
 #include <unistd.h>
+#include <utility>
 #include <vector>
 
 class file_search {
 public:
   file_search(std::string &pattern, argparse::ArgumentParser &program);
+  // With `buffer_output`, each file's output is printed in one go, as
+  // other files are searched and printed concurrently. This is implied
+  // by a scheduler.
   file_search(hs_database_t *database, hs_scratch_t *scratch,
-              const search_options &options);
+              const search_options &options,
+              task_scheduler *scheduler = nullptr, bool buffer_output = false);
   ~file_search();
 
+  // With --shard, chunks are assigned by `shard_path`, the path relative
+  // to the search root (the path itself if empty). A file that is open
+  // already is searched through `fd`, which stays open, and `path` is only
+  // printed.
   void run(std::filesystem::path path,
-           std::optional<std::size_t> maybe_file_size = {});
-  bool scan_line(std::string &line, std::size_t &current_line_number,
-                 bool &break_loop);
+           std::optional<std::size_t> maybe_file_size = {},
+           std::string shard_path = {}, int fd = -1);
+
+  // Search standard input in chunks, as it is read
+  void run_stdin();
 
 private:
   bool mmap_and_scan(std::string &&filename,
-                     std::optional<std::size_t> maybe_file_size = {});
+                     std::optional<std::size_t> maybe_file_size = {},
+                     std::string_view shard_path = {}, int fd = -1);
+
+  // Start the workers and clone their scratch, once, on the first large
+  // file. Returns false if the scratch couldn't be allocated.
+  bool prepare_workers();
 
 private:
   bool non_owning_database{false};
 
+  // If provided, chunks are searched as tasks on this scheduler
+  // instead of on workers of this file_search's own
+  task_scheduler *scheduler{nullptr};
+  bool buffer_output{false};
+
   hs_database_t *database = NULL;
+  // Streaming mode, for standard input
+  streaming_database *stream_database = NULL;
   hs_scratch_t *scratch = NULL;
   hs_database_t *file_filter_database = NULL;
   hs_scratch_t *file_filter_scratch = NULL;
@@ -51,6 +77,13 @@ private:
   bool negate_filter{false};
 
   std::vector<hs_scratch *> thread_local_scratch;
-  std::vector<hs_scratch *> thread_local_scratch_per_line;
+
+  // Without a scheduler, large files are searched on these workers, kept
+  // from one file to the next
+  std::unique_ptr<task_scheduler> own_workers{};
+  // Scratch of each worker, shared by all large files
+  std::vector<hs_scratch *> worker_scratch{};
+  std::once_flag workers_prepared{};
+  bool workers_ready{false};
   search_options options;
 };
@@ -0,0 +1,45 @@
+#pragma once
+#include <cstddef>
+#include <hs/hs.h>
+#include <string>
+#include <vector>
+
+// Named file types (e.g., `cpp`, `py` or `log`), each a set of globs on
+// the file name
+//
+// The globs of the selected (--type) and negated (--type-not) types are
+// compiled into a single Hyperscan database, together with the extensions
+// that are never searched (object files, images, archives etc.), so that
+// each file name is checked with one scan.
+class file_type_filter {
+public:
+  // `definitions` are --type-add specs of the form `name:glob[,glob...]`
+  //
+  // Throws std::runtime_error for an unknown type, a malformed spec or
+  // a glob that doesn't compile
+  file_type_filter(const std::vector<std::string> &selected_types,
+                   const std::vector<std::string> &negated_types,
+                   const std::vector<std::string> &definitions);
+  ~file_type_filter();
+
+  file_type_filter(const file_type_filter &) = delete;
+  file_type_filter &operator=(const file_type_filter &) = delete;
+
+  bool alloc_scratch(hs_scratch_t **scratch) const;
+
+  // Returns true if a file with this name (or relative path)
+  // should be searched
+  bool accept(const char *name, std::size_t length,
+              hs_scratch_t *scratch) const;
+
+private:
+  static int on_match(unsigned int id, unsigned long long from,
+                      unsigned long long to, unsigned int flags, void *ctx);
+
+private:
+  hs_database_t *database{nullptr};
+  bool has_selected_types{false};
+};
+
+// Print every known file type and its globs, for --type-list
+void print_file_types(const std::vector<std::string> &definitions);
@@ -0,0 +1,18 @@
+#pragma once
+#include <cstdint>
+#include <string_view>
+
+// 64-bit FNV-1a, a stable hash for paths
+//
+// Unlike std::hash, the result is the same in every process and on every
+// host, so it can name files on disk or split work between processes.
+constexpr std::uint64_t FNV1A_OFFSET_BASIS = 14695981039346656037ull;
+
+inline std::uint64_t fnv1a(std::string_view data,
+                           std::uint64_t hash = FNV1A_OFFSET_BASIS) {
+  for (const auto c : data) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
@@ -1,6 +1,7 @@
 #pragma once
 #include <argparse/argparse.hpp>
 #include <atomic>
+#include <cerrno>
 #include <chrono>
 #include <concurrentqueue/concurrentqueue.h>
 #include <fcntl.h>
@@ -10,14 +11,19 @@
 #include <fstream>
 #include <git2.h>
 #include <hs/hs.h>
+#include <hypergrep/chunk_reader.hpp>
 #include <hypergrep/compiler.hpp>
 #include <hypergrep/constants.hpp>
+#include <hypergrep/file_batch.hpp>
 #include <hypergrep/file_filter.hpp>
 #include <hypergrep/file_search.hpp>
+#include <hypergrep/inode_set.hpp>
+#include <hypergrep/io_ring.hpp>
 #include <hypergrep/is_binary.hpp>
 #include <hypergrep/match_handler.hpp>
 #include <hypergrep/search_options.hpp>
 #include <hypergrep/size_to_bytes.hpp>
+#include <hypergrep/streaming_database.hpp>
 #include <limits>
 #include <numeric>
 #include <sys/mman.h>
@@ -28,32 +34,87 @@
 
 class git_index_search {
 public:
+  // `search_path` is the repository as given on the command line, which
+  // --exclude-dir patterns are matched against
   git_index_search(std::string &pattern, const std::filesystem::path &path,
+                   std::string_view search_path,
                    argparse::ArgumentParser &program);
-  git_index_search(hs_database_t *database, hs_scratch_t *scratch,
-                   hs_database_t *file_filter_database,
+  git_index_search(hs_database_t *database,
+                   streaming_database *stream_database,
+                   hs_scratch_t *scratch, hs_database_t *file_filter_database,
                    hs_scratch_t *file_filter_scratch,
                    const search_options &options,
                    const std::filesystem::path &path);
   ~git_index_search();
   void run(std::filesystem::path path);
 
+  // Walk the index (and any submodules) of the repository at the base path
+  // without searching anything. Each candidate file is handed to `visitor`
+  // as a path relative to the current directory.
+  //
+  // Used by directory_search to feed nested repositories into its own
+  // scheduler, so no chdir is involved.
+  bool enumerate(const std::function<void(std::string &&)> &visitor);
+
+  // Prune the directories of the index like directory_search prunes its
+  // own, with its --exclude-dir database and a scratch for it. `depth` is
+  // the depth of the repository below the search path and `device` the
+  // device of the search path, for --max-depth and --one-file-system.
+  void prune_directories(hs_database_t *directory_filter_database,
+                         hs_scratch_t *directory_filter_scratch,
+                         std::size_t depth, dev_t device);
+
 private:
   bool process_file(const char *filename, hs_scratch_t *local_scratch,
-                    char *buffer, std::string &lines);
+                    chunk_stream &stream, chunk_reader &reader,
+                    std::string &lines, file_batch *batch);
+
+  // Search an open file, whose first bytes may have been read already
+  // (see chunk_reader::reset). With a `batch`, a tiny file is added to it
+  // instead, and searched by search_batch.
+  bool search_file(int fd, const char *filename, std::string_view first_read,
+                   hs_scratch_t *local_scratch, chunk_stream &stream,
+                   chunk_reader &reader, std::string &lines,
+                   file_batch *batch);
+
+  // Scan the tiny files in `batch` and search the ones with a match
+  void search_batch(file_batch &batch, hs_scratch_t *local_scratch,
+                    chunk_stream &stream, chunk_reader &reader,
+                    std::string &lines);
+
+  // Search a file that passed the checks of search_file, through `fd`
+  // or read whole into `first_read` (fd -1)
+  bool scan_file(int fd, const char *filename, std::string_view first_read,
+                 const struct stat &file_stat, hs_scratch_t *local_scratch,
+                 chunk_stream &stream, chunk_reader &reader,
+                 std::string &lines);
 
   bool search_submodules(const char *dir, git_repository *this_repo);
 
+  // True if `directory`, relative to the repository, is pruned by
+  // --exclude-dir, --max-depth or --one-file-system. Checks only the
+  // components not shared with the previous call, the index is sorted.
+  bool prune_directory(std::string_view directory);
+
   bool visit_git_index(const std::filesystem::path &dir, git_index *index);
 
   bool visit_git_repo(const std::filesystem::path &dir,
                       git_repository *repo = nullptr);
 
-  bool try_dequeue_and_process_path(hs_scratch_t *local_scratch, char *buffer,
-                                    std::string &lines);
+  bool try_dequeue_and_process_path(hs_scratch_t *local_scratch,
+                                    chunk_stream &stream, chunk_reader &reader,
+                                    std::string &lines, file_batch *batch);
 
   void search_thread_function();
 
+  // With --io-depth, search_thread_function keeps up to that many files
+  // being opened and read through io_uring, and searches whichever file
+  // is read first. False if the ring failed on the way, the files left
+  // are then searched with blocking reads.
+  bool search_with_io_ring(io_ring &ring, hs_scratch_t *local_scratch,
+                           chunk_stream &stream, chunk_reader &reader,
+                           std::string &lines);
+
 private:
   static inline bool libgit2_initialized{false};
   std::filesystem::path basepath{};
@@ -67,19 +128,58 @@ private:
 
   bool non_owning_database{false};
   hs_database_t *database = NULL;
+  // Streaming mode, for files read in chunks
+  streaming_database *stream_database = NULL;
   hs_scratch_t *scratch = NULL;
   hs_database_t *file_filter_database = NULL;
   hs_scratch_t *file_filter_scratch = NULL;
+  // For --type and --type-not, allocated on first use
+  hs_scratch_t *file_type_scratch = NULL;
+  // For --glob, allocated on first use
+  hs_scratch_t *glob_scratch = NULL;
+  // For --exclude-dir
+  hs_database_t *directory_filter_database = NULL;
+  hs_scratch_t *directory_filter_scratch = NULL;
+
+  // Path of this (sub)repository relative to the search root,
+  // since --glob matches paths from the root
+  std::string glob_prefix{};
+
+  // Path of this (sub)repository as directory_search would spell it,
+  // with a trailing '/', for --exclude-dir
+  std::string directory_prefix{};
+  // Depth of this (sub)repository below the search path
+  std::size_t base_depth{0};
+  // Device of the search path, for --one-file-system
+  dev_t root_device{0};
+  // Memo of prune_directory
+  std::string checked_directory{};
+  std::string pruned_directory{};
+  std::string directory_path{};
   // If the filter pattern starts with '!'
   // then negate the result of the filter
   bool negate_filter{false};
 
   search_options options;
 
+  // Files already searched, with -L/--follow or --report-aliases
+  std::unique_ptr<inode_set> visited_files;
+
+  // Large files are memory mapped and searched in chunks, see file_search
+  std::unique_ptr<file_search> large_file_searcher;
+
   std::vector<git_repository *> garbage_collect_repo;
   std::vector<git_index *> garbage_collect_index;
   std::vector<git_index_iterator *> garbage_collect_index_iterator;
 
   // Backlog
-  std::vector<std::filesystem::path> submodule_paths;
+  struct submodule {
+    std::filesystem::path path;
+    // Depth below the search path
+    std::size_t depth;
+  };
+  std::vector<submodule> submodules;
+
+  // Set while enumerating
+  const std::function<void(std::string &&)> *file_visitor{nullptr};
 };
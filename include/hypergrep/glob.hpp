@@ -0,0 +1,15 @@
+#pragma once
+#include <string>
+#include <string_view>
+
+// Translate a gitignore-style glob into a regex that Hyperscan can compile
+//
+// The regex matches a path relative to the directory the glob applies to:
+//  - `*` and `?` don't match '/', `[...]` is a character class
+//  - `**/`, `/**/` and `/**` match any number of directories
+//  - a glob with a '/' (other than a trailing one) is anchored to that
+//    directory, otherwise it matches the last components of the path
+//
+// A leading '!' and a trailing '/' are not part of the glob; the caller
+// strips and interprets them
+std::string glob_to_regex(std::string_view glob);
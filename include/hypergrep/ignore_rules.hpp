@@ -0,0 +1,70 @@
+#pragma once
+#include <cstddef>
+#include <hs/hs.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Rules from the ignore files of one directory, compiled into a single
+// Hyperscan database
+//
+// Rules are matched against the path relative to the directory they were
+// found in. Within a directory the last matching rule wins, so `!pattern`
+// re-includes what an earlier rule ignored. A directory's own rules take
+// precedence over the rules inherited from its parents.
+class ignore_rules {
+public:
+  // Ignore files in the order they are applied, i.e., rules in .ignore
+  // override rules in .gitignore
+  static constexpr const char *FILE_NAMES[] = {".gitignore", ".hgignore",
+                                               ".ignore"};
+  static constexpr std::size_t NUM_FILE_NAMES = 3;
+
+  // Index into FILE_NAMES, or NUM_FILE_NAMES if `name` isn't an ignore file
+  static std::size_t file_index(const char *name);
+
+  // `base_length` is the length of the directory path, including the
+  // trailing '/'
+  ignore_rules(const ignore_rules *parent, std::size_t base_length);
+  ~ignore_rules();
+
+  ignore_rules(const ignore_rules &) = delete;
+  ignore_rules &operator=(const ignore_rules &) = delete;
+
+  // Read and parse FILE_NAMES[index] in an open directory
+  void add_file(int directory_fd, std::size_t index);
+
+  // Compile the rules parsed so far. Invalid patterns are reported and
+  // skipped. Returns false if no rule is left.
+  bool compile(std::string_view directory_path);
+
+  // Grow `scratch` to fit these rules and every inherited rule
+  bool alloc_scratch(hs_scratch_t **scratch) const;
+
+  // `path` is the full path of an entry below this directory
+  bool is_ignored(std::string_view path, bool is_directory,
+                  hs_scratch_t *scratch) const;
+
+private:
+  struct rule {
+    bool negated{false};
+    bool directory_only{false};
+  };
+
+  void add_gitignore_line(std::string_view line);
+
+  void add_hgignore_line(std::string_view line, bool &is_glob_syntax);
+
+  static int on_match(unsigned int id, unsigned long long from,
+                      unsigned long long to, unsigned int flags, void *ctx);
+
+private:
+  const ignore_rules *parent{nullptr};
+  std::size_t base_length{0};
+
+  // Regex for each rule, in the order the rules were read
+  std::vector<std::string> patterns{};
+  std::vector<rule> rules{};
+
+  hs_database_t *database{nullptr};
+};
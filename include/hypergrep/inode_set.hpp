@@ -0,0 +1,69 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <unordered_map>
+#include <vector>
+
+// Concurrent set of (st_dev, st_ino) pairs, for -L/--follow
+//
+// Breaks directory cycles and makes sure that a file reached through
+// several paths (symlinks, hardlinks or bind mounts) is searched once.
+// The set is split into shards, each with its own lock, so that workers
+// rarely contend.
+class inode_set {
+public:
+  // With `keep_aliases`, every later path of an inode is recorded so that
+  // it can be reported with print_aliases()
+  explicit inode_set(bool keep_aliases = false);
+
+  // Returns true the first time an inode is seen
+  bool insert(dev_t device, ino_t inode, std::string_view path = {});
+
+  // Aliases are only printed for inodes marked as matched
+  void mark_matched(dev_t device, ino_t inode);
+
+  void print_aliases(bool is_stdout) const;
+
+  void clear();
+
+private:
+  struct key {
+    dev_t device;
+    ino_t inode;
+    bool operator==(const key &other) const {
+      return device == other.device && inode == other.inode;
+    }
+  };
+
+  struct key_hash {
+    std::size_t operator()(const key &k) const {
+      return std::hash<ino_t>{}(k.inode) * 31 + std::hash<dev_t>{}(k.device);
+    }
+  };
+
+  // Only allocated with keep_aliases
+  struct aliases {
+    std::string path{};
+    std::vector<std::string> other_paths{};
+    bool matched{false};
+  };
+
+  struct shard {
+    mutable std::mutex mutex;
+    std::unordered_map<key, std::unique_ptr<aliases>, key_hash> inodes;
+  };
+
+  shard &shard_for(const key &k) {
+    return shards[key_hash{}(k) % NUM_SHARDS];
+  }
+
+private:
+  static constexpr std::size_t NUM_SHARDS = 64;
+  std::array<shard, NUM_SHARDS> shards{};
+  bool keep_aliases{false};
+};
@@ -0,0 +1,78 @@
+#pragma once
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <string_view>
+#include <sys/types.h>
+#include <unordered_map>
+
+// The kind of storage a file is on, which decides how many reads of it
+// are worth keeping in flight
+enum class device_class { local, rotational, network };
+
+constexpr std::size_t NUM_DEVICE_CLASSES = 3;
+
+// Reads in flight per device class, for --io-concurrency
+//
+// A read takes a slot of its file's device class for as long as it runs.
+// Only the reads are limited, the scanning of what was read is not, so
+// data in the page cache is still searched on every core. Local SSDs are
+// not limited by default, network filesystems (NFS, SMB, FUSE, ...) and
+// rotational disks are.
+class io_concurrency {
+public:
+  // A slot held for the duration of a read
+  class slot {
+  public:
+    slot() = default;
+    slot(io_concurrency *owner, device_class c) : owner(owner), c(c) {}
+    ~slot();
+
+    slot(slot &&other) noexcept : owner(other.owner), c(other.c) {
+      other.owner = nullptr;
+    }
+    slot(const slot &) = delete;
+    slot &operator=(const slot &) = delete;
+    slot &operator=(slot &&) = delete;
+
+  private:
+    io_concurrency *owner{nullptr};
+    device_class c{device_class::local};
+  };
+
+  // Limits indexed by device_class, 0 for no limit
+  explicit io_concurrency(
+      const std::array<std::size_t, NUM_DEVICE_CLASSES> &limits);
+
+  io_concurrency(const io_concurrency &) = delete;
+  io_concurrency &operator=(const io_concurrency &) = delete;
+
+  // The class of `device`, from the statfs magic number of its filesystem
+  // and /sys/dev/block/<major>:<minor>/queue/rotational. Looked up once
+  // per device. `fd` is any open file on the device.
+  device_class classify(int fd, dev_t device);
+
+  // Wait for a slot of class `c`
+  slot acquire(device_class c);
+
+private:
+  void release(device_class c);
+
+private:
+  struct class_state {
+    std::size_t limit{0};
+    std::size_t in_flight{0};
+    std::mutex mutex;
+    std::condition_variable cv;
+  };
+  std::array<class_state, NUM_DEVICE_CLASSES> classes{};
+
+  std::mutex devices_mutex;
+  std::unordered_map<dev_t, device_class> devices{};
+};
+
+// Parse --io-concurrency, e.g., "network=4,rotational=1", on top of the
+// default limits. Throws on an unknown class or a malformed limit.
+std::array<std::size_t, NUM_DEVICE_CLASSES>
+parse_io_concurrency(std::string_view spec);
@@ -0,0 +1,68 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// A minimal io_uring, set up with the raw system calls
+//
+// Only what the search needs: openat, read at an offset and close, queued
+// by one thread and completed in any order. Each completion carries the
+// `user_data` of its request.
+class io_ring {
+public:
+  // Room for `entries` queued requests. Check ok() before use, the kernel
+  // may not support io_uring (or these operations), or may not allow it.
+  explicit io_ring(unsigned entries);
+  ~io_ring();
+
+  io_ring(const io_ring &) = delete;
+  io_ring &operator=(const io_ring &) = delete;
+
+  bool ok() const { return ring_fd != -1; }
+
+  // Queue a request, submitting the queue first if it is full
+  // False if the queue is full and can't be submitted right now, e.g.,
+  // until completions are taken. The caller makes the call itself then.
+  bool openat(int dirfd, const char *path, int flags, std::uint64_t user_data);
+  bool read(int fd, char *buffer, unsigned size, std::uint64_t offset,
+            std::uint64_t user_data);
+  bool close(int fd, std::uint64_t user_data);
+
+  // Submit the queued requests and wait for at least one completion
+  // Returns the number of requests submitted, or -errno: -EBUSY and
+  // -EAGAIN mean completions must be taken before trying again, anything
+  // else that the ring can't be used any more.
+  int submit_and_wait();
+
+  // Take back the last queued request that was not submitted, if any
+  // e.g., to make the call without the ring after submit_and_wait failed
+  bool take_queued(std::uint64_t &user_data);
+
+  // Take the next completion, if there is one
+  // `result` is what the system call would return, or -errno
+  bool next_completion(std::uint64_t &user_data, int &result);
+
+private:
+  struct io_uring_sqe *next_sqe();
+  unsigned queued() const;
+  int enter(unsigned to_submit, unsigned min_complete, unsigned flags);
+
+private:
+  int ring_fd{-1};
+
+  void *sq_ring{nullptr};
+  std::size_t sq_ring_size{0};
+  void *cq_ring{nullptr};
+  std::size_t cq_ring_size{0};
+  struct io_uring_sqe *sqes{nullptr};
+  std::size_t sqes_size{0};
+
+  unsigned *sq_head{nullptr};
+  unsigned *sq_tail{nullptr};
+  unsigned *sq_array{nullptr};
+  unsigned sq_mask{0};
+  unsigned sq_entries{0};
+  unsigned *cq_head{nullptr};
+  unsigned *cq_tail{nullptr};
+  struct io_uring_cqe *cqes{nullptr};
+  unsigned cq_mask{0};
+};
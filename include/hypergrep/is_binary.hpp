@@ -20,4 +20,4 @@ bool is_pdf(const char *buffer);
 
 bool starts_with_magic_bytes(const char *buffer, const std::size_t &bytes_read);
 
-bool has_null_bytes(char *buffer, std::size_t search_size);
+bool has_null_bytes(const char *buffer, std::size_t search_size);
@@ -0,0 +1,85 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <hypergrep/directory_reader.hpp>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <sys/stat.h>
+#include <unordered_map>
+#include <utility>
+
+// Directory listings kept on disk between runs, for --listing-cache
+//
+// Each listing is stored under the path of its directory relative to the
+// search root, along with the directory's device, inode, mtime and ctime.
+// Creating, removing or renaming an entry updates the mtime and ctime of
+// its directory, so as long as these are unchanged, the stored listing is
+// current and the directory doesn't need to be opened or read.
+//
+// One cache file is kept per search root, under $XDG_CACHE_HOME/hypergrep
+// (or ~/.cache/hypergrep).
+class listing_cache {
+public:
+  // Load the cache file of this search root, if there is one
+  explicit listing_cache(const std::filesystem::path &root);
+
+  listing_cache(const listing_cache &) = delete;
+  listing_cache &operator=(const listing_cache &) = delete;
+
+  // Find the stored entries of `directory` (see append_entry)
+  // Returns false if there are none, or if `sb` shows they are stale
+  bool find(std::string_view directory, const struct stat &sb,
+            std::string_view &entries) const;
+
+  // Record the complete listing of a directory, read after `sb` was taken
+  // Safe to call from any worker.
+  void store(std::string_view directory, const struct stat &sb,
+             std::string_view entries);
+
+  // Write the cache file back, if anything was stored
+  void save();
+
+  // Serialize a directory entry: type, inode and the NUL-terminated name
+  // Returns the offset of the type, so that it can be resolved later.
+  static std::size_t append_entry(std::string &entries,
+                                  const directory_entry &entry);
+
+private:
+  struct listing {
+    std::uint64_t device{0};
+    std::uint64_t inode{0};
+    std::int64_t mtime_sec{0};
+    std::int64_t mtime_nsec{0};
+    std::int64_t ctime_sec{0};
+    std::int64_t ctime_nsec{0};
+    std::string_view entries{};
+  };
+
+  static listing make_listing(const struct stat &sb);
+
+private:
+  std::string root{};
+  std::filesystem::path file{};
+
+  // The contents of the cache file, and the listings found in it
+  std::string contents{};
+  std::unordered_map<std::string_view, listing> listings{};
+
+  // Listings read during this run, with their entries
+  std::mutex mutex;
+  std::unordered_map<std::string, std::pair<listing, std::string>> stored{};
+};
+
+// Iterates over the entries of a listing from the cache, like
+// directory_reader does for an open directory
+class cached_listing_reader {
+public:
+  explicit cached_listing_reader(std::string_view entries);
+
+  bool next(directory_entry &entry);
+
+private:
+  std::string_view entries{};
+};
@@ -6,6 +6,7 @@
 #include <hypergrep/file_context.hpp>
 #include <hypergrep/trim_whitespace.hpp>
 #include <optional>
+#include <string>
 #include <string_view>
 #include <vector>
 
@@ -16,8 +17,39 @@ int print_match_in_red_color(unsigned int id, unsigned long long from,
                              unsigned long long to, unsigned int flags,
                              void *ctx);
 
+// Scan a chunk of a file with a stream started at the start of the file
+// The match offsets are made relative to the chunk. After the last chunk
+// the stream is reset, which reports the matches at the end of the file.
+hs_error_t scan_chunk(hs_stream_t *stream, hs_scratch_t *scratch,
+                      std::string_view chunk, std::size_t chunk_offset,
+                      bool last_chunk, file_context &ctx);
+
+// Matches in a line too long to be read whole, counted piece by piece
+// and printed as an omitted line once the line ends
+struct long_line_matches {
+  void add_piece(std::string_view piece, std::size_t piece_line_number,
+                 std::size_t number_of_matches_in_piece);
+
+  bool has_matches() const { return number_of_matches > 0; }
+
+  // Returns the number of matching lines (0 or 1)
+  std::size_t finish(std::string &lines, const char *filename,
+                     bool print_filename, bool is_stdout,
+                     bool show_line_numbers);
+
+  std::size_t line_number{0};
+  std::size_t number_of_matches{0};
+  bool in_line{false};
+};
+
+// Print a line that is too long to show, with its number of matches
+void append_omitted_line(std::string &lines, const char *filename,
+                         std::size_t line_number,
+                         std::size_t number_of_matches, bool print_filename,
+                         bool is_stdout, bool show_line_numbers);
+
 std::size_t process_matches(
-    const char *filename, char *buffer, std::size_t bytes_read,
+    const char *filename, const char *buffer, std::size_t bytes_read,
     std::vector<std::pair<unsigned long long, unsigned long long>> &matches,
     std::size_t &current_line_number, std::string &lines, bool print_filename,
     bool is_stdout, bool show_line_numbers, bool show_column_numbers,
@@ -26,7 +58,7 @@ std::size_t process_matches(
     bool ltrim_each_output_line);
 
 std::size_t process_matches_nocolor_nostdout(
-    const char *filename, char *buffer, std::size_t bytes_read,
+    const char *filename, const char *buffer, std::size_t bytes_read,
     std::vector<std::pair<unsigned long long, unsigned long long>> &matches,
     std::size_t &current_line_number, std::string &lines, bool print_filename,
     bool is_stdout, bool show_line_numbers, bool show_column_numbers,
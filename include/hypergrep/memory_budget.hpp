@@ -0,0 +1,27 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+
+// Memory held by a search, for --max-memory
+//
+// Covers the read buffers of the workers, the results of large file
+// chunks waiting to be printed and the output buffered for a large file.
+// Memory is always granted, the budget only says when to hold back: the
+// search of a large file stops running ahead of its printing while the
+// budget is exhausted, and buffered output is printed early.
+class memory_budget {
+public:
+  explicit memory_budget(std::size_t limit) : limit(limit) {}
+
+  memory_budget(const memory_budget &) = delete;
+  memory_budget &operator=(const memory_budget &) = delete;
+
+  void acquire(std::size_t bytes) { used += bytes; }
+  void release(std::size_t bytes) { used -= bytes; }
+
+  bool exhausted() const { return used >= limit; }
+
+private:
+  const std::size_t limit;
+  std::atomic<std::size_t> used{0};
+};
@@ -0,0 +1,85 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <hypergrep/io_concurrency.hpp>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class ignore_rules;
+
+// A directory discovered during traversal, stored as a (parent, name)
+// record. The name follows the record in memory. Directory records live
+// in a path_arena until the end of the search since their descendants
+// refer to them to build paths.
+struct directory_node {
+  directory_node *parent{nullptr};
+
+  // Kept open while entries of this directory are pending,
+  // so that they can be opened with openat()
+  int fd{-1};
+
+  // Entries still to be processed, plus one for the directory itself
+  // When this drops to zero, fd is closed and files are released
+  std::atomic<std::uint32_t> num_pending{0};
+
+  // Records of the files in this directory, see file_node
+  char *files{nullptr};
+
+  // 0 for the search root
+  std::uint32_t depth{0};
+
+  // The device class of the directory, for --io-concurrency. Inherited
+  // from the parent until the directory itself is stat'ed.
+  device_class io_class{device_class::local};
+
+  // Ignore files of this directory and its parents, if any
+  const ignore_rules *ignore{nullptr};
+
+  std::uint32_t name_length{0};
+
+  const char *name() const { return reinterpret_cast<const char *>(this + 1); }
+};
+
+// A file to search, stored as a (parent, name) record in the files block
+// of its directory. The name may contain '/' (e.g., git index entries) and
+// follows the record in memory.
+struct file_node {
+  directory_node *parent{nullptr};
+  std::uint32_t name_length{0};
+
+  const char *name() const { return reinterpret_cast<const char *>(this + 1); }
+};
+
+// Append-only, single-writer storage for directory records
+//
+// Each scheduler worker owns one arena. Records are never freed
+// individually; the arena is reset once the search is done.
+class path_arena {
+public:
+  directory_node *make_directory(directory_node *parent, std::string_view name);
+
+  void reset();
+
+private:
+  static constexpr std::size_t BLOCK_SIZE = 64 * 1024;
+
+  std::vector<std::unique_ptr<char[]>> blocks{};
+  std::size_t num_blocks{0};
+  char *cursor{nullptr};
+  std::size_t remaining{0};
+};
+
+// Pack file records into a single allocation
+//
+// `names` holds NUL-terminated names back to back and `offsets` the
+// start of each name to pack
+char *make_file_block(directory_node *parent, const std::string &names,
+                      const std::vector<std::uint32_t> &offsets,
+                      std::vector<file_node *> &nodes);
+
+// Append the path of a directory (or a file) to `out`
+void append_path(const directory_node *directory, std::string &out);
+void append_path(const file_node *file, std::string &out);
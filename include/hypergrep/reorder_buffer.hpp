@@ -0,0 +1,101 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+// Hands out items in sequence order, whatever order they are put in
+//
+// Producers put items numbered 0, 1, 2, ... and the consumer takes them
+// back in that order, waiting (without spinning) for the next one. Only
+// the items from the next expected one to the furthest one put are held.
+// Once every producer is done, the items end at the first missing one.
+template <typename T> class reorder_buffer {
+public:
+  enum class status { ready, pending, done };
+
+  explicit reorder_buffer(std::size_t num_producers)
+      : producers_left(num_producers) {}
+
+  reorder_buffer(const reorder_buffer &) = delete;
+  reorder_buffer &operator=(const reorder_buffer &) = delete;
+
+  void put(std::size_t sequence, T &&item) {
+    bool is_next{false};
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      const std::size_t index = sequence - next;
+      if (index >= window.size()) {
+        window.resize(index + 1);
+      }
+      window[index].emplace(std::move(item));
+      is_next = index == 0;
+    }
+    if (is_next) {
+      cv.notify_one();
+    }
+  }
+
+  // Called by each producer once it has put all its items, as the last
+  // thing it does with the buffer. The consumer is notified under the lock,
+  // so that it may destroy the buffer as soon as it sees every producer done.
+  void producer_done() {
+    std::lock_guard<std::mutex> lock(mutex);
+    producers_left -= 1;
+    cv.notify_all();
+  }
+
+  // True once every producer is done
+  bool done() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return producers_left == 0;
+  }
+
+  // Wait up to `max_wait` for every producer to be done
+  template <typename Duration> bool wait_done(Duration max_wait) {
+    std::unique_lock<std::mutex> lock(mutex);
+    return cv.wait_for(lock, max_wait,
+                       [this]() { return producers_left == 0; });
+  }
+
+  // Take the next item if it is there
+  status try_take(T &item) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return take_locked(item);
+  }
+
+  // Take the next item, waiting up to `max_wait` for it
+  template <typename Duration> status take(T &item, Duration max_wait) {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait_for(lock, max_wait, [this]() {
+      return (!window.empty() && window.front()) || producers_left == 0;
+    });
+    return take_locked(item);
+  }
+
+  // Sequence number of the next item to be taken
+  std::size_t next_sequence() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return next;
+  }
+
+private:
+  status take_locked(T &item) {
+    if (window.empty() || !window.front()) {
+      return producers_left == 0 ? status::done : status::pending;
+    }
+    item = std::move(*window.front());
+    window.pop_front();
+    next += 1;
+    return status::ready;
+  }
+
+private:
+  mutable std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<std::optional<T>> window{};
+  std::size_t next{0};
+  std::size_t producers_left{0};
+};
@@ -0,0 +1,70 @@
+#pragma once
+#include <argparse/argparse.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string_view>
+
+// Keeps a search within --io-limit and --cpu-limit
+//
+// Every read of a file (chunked reads, tiny files, io_uring reads and the
+// chunks of memory mapped large files) goes through pace(), on whichever
+// thread does it. The I/O limit is a token bucket shared by all of them:
+// a read that would overdraw it sleeps until enough bytes have accrued.
+// The CPU limit compares the CPU time of the process with the wall time
+// since the start. While the process is over budget, each worker that
+// reaches a read pauses, so fewer workers are active. A worker waiting on
+// the disk uses no CPU, so I/O-bound phases aren't throttled. Threads
+// that poll for work pause too, or they would use up the budget.
+class resource_governor {
+public:
+  // `io_bytes_per_second` and `cpu_cores` are the limits, if any
+  resource_governor(std::optional<std::size_t> io_bytes_per_second,
+                    std::optional<double> cpu_cores);
+
+  resource_governor(const resource_governor &) = delete;
+  resource_governor &operator=(const resource_governor &) = delete;
+
+  // Account for a read of `bytes`, waiting as long as the limits require
+  void pace(std::size_t bytes);
+
+  // Pause while the process is over its CPU budget
+  // For threads that poll for work, which use CPU without reading.
+  void throttle_cpu();
+
+  // Print the throughput achieved against each limit to stderr
+  void print_report() const;
+
+private:
+  using clock = std::chrono::steady_clock;
+
+  void wait_for_io(std::size_t bytes);
+
+  std::int64_t elapsed_ns() const;
+
+private:
+  const std::optional<std::size_t> io_bytes_per_second;
+  const std::optional<double> cpu_cores;
+  const clock::time_point start;
+  const std::int64_t start_cpu_ns;
+
+  // Time (since `start`) by which all bytes granted so far have accrued
+  std::atomic<std::int64_t> io_ready_ns{0};
+
+  // Totals for the report, the waits summed over all threads
+  std::atomic<std::size_t> bytes_read{0};
+  std::atomic<std::int64_t> io_wait_ns{0};
+  std::atomic<std::int64_t> cpu_wait_ns{0};
+};
+
+// Set the I/O priority class of the process from --ioprio (idle or
+// best-effort). Threads started afterwards inherit it.
+void set_io_priority(std::string_view io_class);
+
+// The governor shared by every search of this run (null without
+// --io-limit or --cpu-limit)
+std::shared_ptr<resource_governor>
+shared_resource_governor(argparse::ArgumentParser &program);
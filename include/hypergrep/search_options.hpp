@@ -2,10 +2,22 @@
 #include <argparse/argparse.hpp>
 #include <cstdint>
 #include <hypergrep/file_filter.hpp>
+#include <hypergrep/file_types.hpp>
+#include <hypergrep/io_concurrency.hpp>
+#include <hypergrep/memory_budget.hpp>
+#include <hypergrep/resource_governor.hpp>
+#include <hypergrep/shard.hpp>
 #include <hypergrep/size_to_bytes.hpp>
+#include <memory>
 #include <optional>
 #include <string>
 #include <unistd.h>
+#include <vector>
+
+class streaming_database;
+
+// Order in which the files found by a directory search are read
+enum class file_read_order { traversal, inode, extent };
 
 struct search_options {
   bool perform_search{true};
@@ -32,9 +44,61 @@ struct search_options {
   bool ignore_gitindex{false};
   bool compile_pattern_as_literal{false};
   bool ltrim_each_output_line{false};
+
+  // Directory pruning during traversal
+  std::vector<std::string> exclude_directory_patterns{};
+  std::optional<std::size_t> max_depth{};
+  bool one_file_system{false};
+
+  // Honor .gitignore, .ignore and .hgignore outside git repositories
+  bool respect_ignore_files{true};
+
+  // -L/--follow, and searching each inode once
+  bool follow_symlinks{false};
+  bool report_aliases{false};
+  bool deduplicate_inodes{false};
+
+  // --listing-cache
+  bool cache_listings{false};
+
+  // --shard i/n, if any
+  std::optional<shard_spec> shard{};
+
+  // --sort-files
+  file_read_order read_order{file_read_order::traversal};
+
+  // --io-depth, files opened and read through io_uring per search thread
+  // (0 for blocking reads)
+  std::size_t io_depth{0};
+
+  // --no-cache, read files without filling the page cache
+  bool no_cache{false};
+
+  // --io-limit and --cpu-limit, if any (shared by all searches of a run)
+  std::shared_ptr<resource_governor> governor{};
+
+  // Reads in flight per device class, see --io-concurrency
+  std::shared_ptr<io_concurrency> device_limits{};
+
+  // --max-memory, if any
+  std::shared_ptr<memory_budget> memory{};
+
+  // Tiny files are scanned in batches (see file_batch), unless a pattern
+  // may be anchored to the start or end of the data, or files without
+  // matches are printed too
+  bool batch_tiny_files{false};
+
+  // --type, --type-not and the file extensions that are never searched
+  std::shared_ptr<const file_type_filter> file_types{};
+
+  // --glob and --iglob, if any
+  std::shared_ptr<const glob_filter> globs{};
 };
 
+// With `stream_database`, the patterns are also set up to be compiled in
+// streaming mode (for files read in chunks), once that is needed
 void initialize_search(std::string &pattern, argparse::ArgumentParser &program,
                        search_options &options, hs_database **database,
                        hs_scratch **scratch, hs_database **file_filter_database,
-                       hs_scratch **file_filter_scratch);
\ No newline at end of file
+                       hs_scratch **file_filter_scratch,
+                       streaming_database **stream_database = nullptr);
\ No newline at end of file
@@ -0,0 +1,36 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// --shard i/n splits one search between n processes that don't talk to
+// each other
+//
+// Each file is assigned to one shard by a stable hash of its path relative
+// to the search root, and each chunk of a large file by the hash of its
+// path and chunk index. Together, the n runs search everything that an
+// unsharded run would, exactly once.
+struct shard_spec {
+  // 0-based, i.e., --shard 1/4 has index 0
+  std::size_t index{0};
+  std::size_t count{1};
+};
+
+// Parse `i/n` with 1 <= i <= n
+// Throws std::runtime_error if the spec is malformed
+shard_spec parse_shard(std::string_view spec);
+
+// `path` is relative to the search root. A leading "./" is ignored, so
+// that the same file lands in the same shard however it was reached.
+bool in_shard(const shard_spec &shard, std::string_view path);
+
+bool in_shard(const shard_spec &shard, std::string_view path,
+              std::size_t chunk_index);
+
+// The key to shard a file by when it may be reached by several paths (with
+// -L or --report-aliases, each inode is searched once)
+//
+// Which path is seen first depends on the timing of each run, so the file
+// goes by its inode number instead, which every shard agrees on.
+std::string inode_shard_key(std::uint64_t inode);
@@ -0,0 +1,68 @@
+#pragma once
+#include <hs/hs.h>
+#include <hypergrep/file_context.hpp>
+#include <hypergrep/search_options.hpp>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The patterns compiled in streaming mode, once a file is read in chunks
+//
+// Memory mapped files are scanned with the block mode database only, so
+// the streaming mode one is compiled on first use rather than with it.
+// Streaming mode is also stricter (on stream state, and on start of match
+// offsets): patterns that compile in block mode may not compile here.
+// get() then warns once and returns null, and the chunks are scanned with
+// the block mode database instead.
+class streaming_database {
+public:
+  streaming_database(const search_options &options,
+                     std::vector<std::string> pattern_list);
+  ~streaming_database();
+
+  streaming_database(const streaming_database &) = delete;
+  streaming_database &operator=(const streaming_database &) = delete;
+
+  // Compiles the database on the first call, from any thread
+  hs_database_t *get();
+
+private:
+  search_options options{};
+  std::vector<std::string> pattern_list{};
+
+  std::once_flag compiled{};
+  hs_database_t *database{nullptr};
+};
+
+// One thread's stream, scanning the chunks of one file after the other
+//
+// The stream and its scratch are allocated on first use. Without a
+// streaming mode database, each chunk is scanned on its own in block mode
+// and matches don't carry from one chunk to the next.
+class chunk_stream {
+public:
+  chunk_stream(const hs_database_t *block_database,
+               streaming_database *database);
+  ~chunk_stream();
+
+  chunk_stream(const chunk_stream &) = delete;
+  chunk_stream &operator=(const chunk_stream &) = delete;
+
+  // Start a new file
+  void reset();
+
+  // See scan_chunk. `block_scratch` is the scratch of the block mode
+  // database, for when there is no stream.
+  hs_error_t scan(hs_scratch_t *block_scratch, std::string_view chunk,
+                  std::size_t chunk_offset, bool last_chunk,
+                  file_context &ctx);
+
+private:
+  const hs_database_t *block_database{nullptr};
+  streaming_database *database{nullptr};
+
+  bool opened{false};
+  hs_stream_t *stream{nullptr};
+  hs_scratch_t *scratch{nullptr};
+};
@@ -0,0 +1,89 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing task scheduler
+//
+// Each worker owns a deque of tasks. A worker pushes and pops at the back of
+// its own deque (depth-first, cache friendly) and, once it runs dry, steals
+// from the front of the other deques (oldest, usually largest, units of
+// work). Tasks submitted from outside the pool go to a shared injection
+// queue.
+//
+// Idle workers park on a condition variable instead of spinning. wait()
+// returns once every submitted task, including the tasks those tasks
+// submitted, has finished.
+//
+// Leaf tasks (see submit_leaf) sit in deques of their own, next to the
+// others, and are picked up first.
+class task_scheduler {
+public:
+  using task = std::function<void(std::size_t worker_index)>;
+
+  explicit task_scheduler(std::size_t num_workers);
+  ~task_scheduler();
+
+  task_scheduler(const task_scheduler &) = delete;
+  task_scheduler &operator=(const task_scheduler &) = delete;
+
+  std::size_t num_workers() const { return workers.size(); }
+
+  void submit(task &&t);
+
+  // Submit a task that never waits for other tasks, e.g., the scan of
+  // some chunks of a large file
+  void submit_leaf(task &&t);
+
+  // Run one pending leaf task on the calling worker, if there is one
+  //
+  // A task that has to wait for other tasks (e.g., the in-order consumer of
+  // a large file) calls this instead of blocking its worker. Only leaf
+  // tasks are run, so a waiting task never ends up under another one
+  // (e.g., the consumer of another large file) and waits don't nest.
+  // Returns false when called from outside this scheduler.
+  bool try_run_pending_task();
+
+  // Block until all submitted tasks have finished
+  void wait();
+
+private:
+  struct worker_queue {
+    std::mutex mutex;
+    std::deque<task> tasks;
+    std::deque<task> leaf_tasks;
+  };
+
+  void worker_function(std::size_t worker_index);
+
+  void push(task &&t, bool leaf);
+
+  bool try_pop(std::size_t worker_index, task &t, bool leaf_only);
+
+  void run_task(task &t, std::size_t worker_index);
+
+private:
+  std::vector<std::unique_ptr<worker_queue>> queues;
+  worker_queue injection_queue;
+  std::vector<std::thread> workers;
+
+  // Number of tasks sitting in a deque, waiting to be picked up
+  std::atomic<std::size_t> num_queued{0};
+
+  // Number of tasks submitted but not yet finished
+  std::atomic<std::size_t> num_pending{0};
+
+  std::mutex park_mutex;
+  std::condition_variable park_cv;
+  std::atomic<std::size_t> num_parked{0};
+  bool stopping{false};
+
+  std::mutex done_mutex;
+  std::condition_variable done_cv;
+};
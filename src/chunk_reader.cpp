@@ -0,0 +1,181 @@
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <hypergrep/chunk_reader.hpp>
+#include <hypergrep/constants.hpp>
+#include <unistd.h>
+
+namespace {
+
+constexpr std::size_t BUFFER_SIZE = CHUNK_READER_BUFFER_SIZE;
+
+// O_DIRECT reads need the buffer, the file offset and the size aligned to
+// the logical block size of the device, at most a page
+constexpr std::size_t DIRECT_IO_ALIGNMENT = TYPICAL_FILESYSTEM_BLOCK_SIZE;
+
+std::size_t align_up(std::size_t value) {
+  return (value + DIRECT_IO_ALIGNMENT - 1) & ~(DIRECT_IO_ALIGNMENT - 1);
+}
+
+} // namespace
+
+chunk_reader::chunk_reader(bool bypass_cache, resource_governor *governor,
+                           io_concurrency *device_limits)
+    : storage(std::make_unique<char[]>(BUFFER_SIZE + DIRECT_IO_ALIGNMENT)),
+      bypass_cache(bypass_cache), governor(governor),
+      device_limits(device_limits) {
+  buffer = storage.get() +
+           (align_up(reinterpret_cast<std::uintptr_t>(storage.get())) -
+            reinterpret_cast<std::uintptr_t>(storage.get()));
+}
+
+void chunk_reader::start_direct_io() {
+  const int flags = fcntl(fd, F_GETFL);
+  direct_io = flags != -1 && ((flags & O_DIRECT) ||
+                              fcntl(fd, F_SETFL, flags | O_DIRECT) == 0);
+}
+
+void chunk_reader::stop_direct_io() {
+  const int flags = fcntl(fd, F_GETFL);
+  if (flags != -1) {
+    fcntl(fd, F_SETFL, flags & ~O_DIRECT);
+  }
+  direct_io = false;
+}
+
+void chunk_reader::reset(int fd, std::string_view first_read,
+                         std::optional<std::size_t> file_size,
+                         device_class io_class) {
+  this->fd = fd;
+  this->io_class = io_class;
+  std::memcpy(buffer, first_read.data(), first_read.size());
+  begin = 0;
+  end = first_read.size();
+  unscanned_offset = 0;
+  offset = 0;
+  total_bytes_read = first_read.size();
+  expected_size = file_size.value_or(0);
+  at_end_of_file =
+      (!first_read.empty() && first_read.size() < FILE_CHUNK_SIZE) ||
+      (expected_size > 0 && total_bytes_read >= expected_size);
+  is_pipe = false;
+  in_long_line = false;
+
+  direct_io = false;
+  if (bypass_cache && fd != -1) {
+    // The first read, if any, went through the page cache
+    if (!first_read.empty()) {
+      posix_fadvise(fd, 0, at_end_of_file ? 0 : first_read.size(),
+                    POSIX_FADV_DONTNEED);
+    }
+    if (!at_end_of_file) {
+      start_direct_io();
+    }
+  }
+}
+
+chunk_reader::status chunk_reader::next(std::string_view &chunk) {
+  while (true) {
+    if (begin < end && in_long_line) {
+      // The long line ends at the next newline
+      const auto newline = static_cast<const char *>(
+          std::memchr(buffer + begin, '\n', end - begin));
+      if (newline) {
+        in_long_line = false;
+        if (newline != buffer + begin) {
+          return take(newline - buffer, status::line_piece, chunk);
+        }
+      } else if (at_end_of_file) {
+        return take(end, status::line_piece, chunk);
+      } else if (end - begin >= FILE_CHUNK_SIZE) {
+        // Hold back one byte, so that the last chunk is never empty
+        return take(end - 1, status::line_piece, chunk);
+      }
+    }
+
+    if (begin < end && !in_long_line) {
+      if (at_end_of_file) {
+        return take(end, status::chunk, chunk);
+      }
+
+      // Stop at the last newline. The first byte is skipped, it may be
+      // the newline the previous chunk stopped at.
+      const auto last_newline = static_cast<const char *>(
+          memrchr(buffer + begin + 1, '\n', end - begin - 1));
+      if (last_newline) {
+        return take(last_newline - buffer, status::chunk, chunk);
+      }
+      if (end - begin >= FILE_CHUNK_SIZE) {
+        in_long_line = true;
+        return take(end - 1, status::line_piece, chunk);
+      }
+    }
+
+    if (at_end_of_file) {
+      return status::end_of_file;
+    }
+
+    // Make room for a full read. What's left is less than a chunk. It is
+    // moved so that it ends aligned, where the next read starts.
+    if (BUFFER_SIZE - end < FILE_CHUNK_SIZE) {
+      const std::size_t rest = end - begin;
+      const std::size_t new_begin = align_up(rest) - rest;
+      std::memmove(buffer + new_begin, buffer + begin, rest);
+      begin = new_begin;
+      end = new_begin + rest;
+    }
+
+    ssize_t ret{0};
+    if (!is_pipe) {
+      const auto slot = device_limits ? device_limits->acquire(io_class)
+                                      : io_concurrency::slot{};
+      ret = pread(fd, buffer + end, FILE_CHUNK_SIZE, total_bytes_read);
+      if (ret == -1 && errno == ESPIPE) {
+        is_pipe = true;
+        continue;
+      }
+      if (ret == -1 && errno == EINVAL && direct_io) {
+        // Accepted by open, but not by this filesystem
+        stop_direct_io();
+        continue;
+      }
+    } else {
+      ret = read(fd, buffer + end, FILE_CHUNK_SIZE);
+    }
+    if (ret == -1 && errno == EINTR) {
+      continue;
+    }
+    if (ret <= 0) {
+      at_end_of_file = true;
+      continue;
+    }
+    if (governor) {
+      governor->pace(ret);
+    }
+
+    const std::size_t read_offset = total_bytes_read;
+    end += ret;
+    total_bytes_read += ret;
+    if (!is_pipe && (static_cast<std::size_t>(ret) < FILE_CHUNK_SIZE ||
+                     (expected_size > 0 && total_bytes_read >= expected_size))) {
+      at_end_of_file = true;
+    }
+
+    // Drop what was just read (to the end of the file, with the last
+    // partial page)
+    if (bypass_cache && !direct_io && !is_pipe) {
+      posix_fadvise(fd, read_offset, at_end_of_file ? 0 : ret,
+                    POSIX_FADV_DONTNEED);
+    }
+  }
+}
+
+chunk_reader::status chunk_reader::take(std::size_t chunk_end, status kind,
+                                        std::string_view &chunk) {
+  chunk = std::string_view(buffer + begin, chunk_end - begin);
+  offset = unscanned_offset;
+  unscanned_offset += chunk.size();
+  begin = chunk_end;
+  return kind;
+}
@@ -15,14 +15,22 @@ unsigned int get_cpu_features_flag() {
 }
 
 void compile_hs_database(hs_database **database, hs_scratch **scratch,
-                         search_options &options,
-                         const std::vector<std::string> &pattern_list) {
+                         const search_options &options,
+                         const std::vector<std::string> &pattern_list,
+                         unsigned int mode) {
 
   hs_error_t error_code;
   hs_compile_error_t *compile_error = NULL;
 
   static const auto cpu_features_flag = get_cpu_features_flag();
 
+  // Start of match offsets need a horizon in streaming mode
+  if (mode == HS_MODE_STREAM &&
+      (options.is_stdout || options.print_only_matching_parts ||
+       options.show_column_numbers || options.show_byte_offset)) {
+    mode |= HS_MODE_SOM_HORIZON_LARGE;
+  }
+
   if (pattern_list.size() == 1) {
     const auto &pattern = pattern_list[0];
 
@@ -35,7 +43,7 @@ void compile_hs_database(hs_database **database, hs_scratch **scratch,
                    ? HS_FLAG_SOM_LEFTMOST
                    : 0) |
               cpu_features_flag,
-          pattern.size(), HS_MODE_BLOCK, NULL, database, &compile_error);
+          pattern.size(), mode, NULL, database, &compile_error);
     } else {
       error_code = hs_compile(
           pattern.data(),
@@ -46,7 +54,7 @@ void compile_hs_database(hs_database **database, hs_scratch **scratch,
                    ? HS_FLAG_SOM_LEFTMOST
                    : 0) |
               cpu_features_flag,
-          HS_MODE_BLOCK, NULL, database, &compile_error);
+          mode, NULL, database, &compile_error);
     }
   } else {
     // Compile multiple patterns
@@ -87,13 +95,13 @@ void compile_hs_database(hs_database **database, hs_scratch **scratch,
       error_code =
           hs_compile_lit_multi(pattern_list_c.data(), flags.data(),
                                NULL, // list of IDs - NULL means all zero
-                               lens.data(), pattern_list.size(), HS_MODE_BLOCK,
+                               lens.data(), pattern_list.size(), mode,
                                NULL, database, &compile_error) |
           cpu_features_flag;
     } else {
       error_code = hs_compile_multi(pattern_list_c.data(), flags.data(),
                                     NULL, // list of IDs - NULL means all zero
-                                    pattern_list.size(), HS_MODE_BLOCK, NULL,
+                                    pattern_list.size(), mode, NULL,
                                     database, &compile_error) |
                    cpu_features_flag;
     }
@@ -0,0 +1,57 @@
+#include <fcntl.h>
+#include <hypergrep/directory_reader.hpp>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Layout of the records returned by getdents64(2)
+struct linux_dirent64 {
+  std::uint64_t d_ino;
+  std::int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[1];
+};
+
+directory_reader::directory_reader(int fd, char *buffer,
+                                   std::size_t buffer_size)
+    : fd(fd), buffer(buffer), buffer_size(buffer_size) {}
+
+bool directory_reader::next(directory_entry &entry) {
+  if (offset >= bytes_in_buffer) {
+    auto ret = syscall(SYS_getdents64, fd, buffer, buffer_size);
+    if (ret <= 0) {
+      return false;
+    }
+    bytes_in_buffer = ret;
+    offset = 0;
+  }
+
+  auto record = reinterpret_cast<linux_dirent64 *>(buffer + offset);
+  offset += record->d_reclen;
+
+  entry.name = record->d_name;
+  entry.type = record->d_type;
+  entry.inode = record->d_ino;
+  return true;
+}
+
+unsigned char resolve_entry_type(int dirfd, const char *name,
+                                 bool follow_symlinks) {
+  struct stat sb;
+  if (fstatat(dirfd, name, &sb, follow_symlinks ? 0 : AT_SYMLINK_NOFOLLOW) ==
+      -1) {
+    return DT_UNKNOWN;
+  }
+
+  switch (sb.st_mode & S_IFMT) {
+  case S_IFDIR:
+    return DT_DIR;
+  case S_IFREG:
+    return DT_REG;
+  case S_IFLNK:
+    return DT_LNK;
+  default:
+    return DT_UNKNOWN;
+  }
+}
@@ -2,15 +2,155 @@
 #include <hypergrep/is_binary.hpp>
 #include <hypergrep/trim_whitespace.hpp>
 
+namespace {
+
+// Names in a listing are NUL terminated and followed by the inode number
+// of the entry, so that --sort-files inode doesn't need a stat
+void append_name(std::string &names, std::string_view name,
+                 std::uint64_t inode) {
+  names += name;
+  names += '\0';
+  names.append(reinterpret_cast<const char *>(&inode), sizeof(inode));
+}
+
+std::uint64_t name_inode(const std::string &names, std::uint32_t offset) {
+  const char *name = &names[offset];
+  std::uint64_t inode;
+  std::memcpy(&inode, name + strlen(name) + 1, sizeof(inode));
+  return inode;
+}
+
+// --sort-files batches hold at least this many files, and more while
+// many directories are still waiting to be listed
+constexpr std::size_t MIN_ORDERED_BATCH_SIZE = 64;
+constexpr std::size_t MAX_ORDERED_BATCH_SIZE = 16384;
+constexpr std::size_t ORDERED_BATCH_SIZE_PER_DIRECTORY = 32;
+
+// With tiny files batched, the files of a directory are searched in tasks
+// of up to this many files, each task scanning its tiny files at once
+constexpr std::size_t FILES_PER_TASK = 16;
+
+} // namespace
+
 directory_search::directory_search(std::string &pattern,
                                    const std::filesystem::path &path,
                                    argparse::ArgumentParser &program)
     : search_path(path) {
   initialize_search(pattern, program, options, &database, &scratch,
-                    &file_filter_database, &file_filter_scratch);
+                    &file_filter_database, &file_filter_scratch,
+                    &stream_database);
+
+  if (!options.exclude_directory_patterns.empty()) {
+    if (!construct_directory_filtering_hs_database(
+            &directory_filter_database, &directory_filter_scratch, options)) {
+      throw std::runtime_error("Error compiling --exclude-dir patterns");
+    }
+  }
+
+  if (options.deduplicate_inodes) {
+    visited_directories = std::make_unique<inode_set>();
+    visited_files = std::make_unique<inode_set>(options.report_aliases);
+  }
+
+  scheduler = std::make_unique<task_scheduler>(options.num_threads);
+
+  worker_states.resize(scheduler->num_workers());
+  for (auto &state : worker_states) {
+    if (options.perform_search) {
+      if (hs_alloc_scratch(database, &state.scratch) != HS_SUCCESS) {
+        throw std::runtime_error("Error allocating scratch space\n");
+      }
+      state.stream = std::make_unique<chunk_stream>(database, stream_database);
+      state.reader = std::make_unique<chunk_reader>(
+          options.no_cache, options.governor.get(),
+          options.device_limits.get());
+      if (options.batch_tiny_files) {
+        state.batch = std::make_unique<file_batch>(
+            options.no_cache, options.governor.get(),
+            options.device_limits.get());
+      }
+    }
+    state.directory_buffer = std::make_unique<char[]>(DIRECTORY_BUFFER_SIZE);
+
+    if (options.memory) {
+      options.memory->acquire(DIRECTORY_BUFFER_SIZE +
+                              (state.reader ? CHUNK_READER_BUFFER_SIZE : 0) +
+                              (state.batch ? FILE_BATCH_SIZE : 0));
+    }
+
+    if (!options.file_types->alloc_scratch(&state.file_type_scratch)) {
+      throw std::runtime_error("Error allocating scratch space\n");
+    }
+
+    if (options.globs && !options.globs->alloc_scratch(&state.glob_scratch)) {
+      throw std::runtime_error("Error allocating scratch space\n");
+    }
+
+    if (options.filter_files) {
+      hs_error_t database_error = hs_alloc_scratch(
+          file_filter_database, &state.file_filter_scratch);
+      if (database_error != HS_SUCCESS) {
+        throw std::runtime_error("Error allocating scratch space\n");
+      }
+    }
+
+    if (directory_filter_database) {
+      hs_error_t database_error = hs_alloc_scratch(
+          directory_filter_database, &state.directory_filter_scratch);
+      if (database_error != HS_SUCCESS) {
+        throw std::runtime_error("Error allocating scratch space\n");
+      }
+    }
+  }
+
+  // Leave half of the fd limit for the files being searched
+  // and for everything else
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+    max_retained_fds = limit.rlim_cur / 2;
+  } else {
+    max_retained_fds = 512;
+  }
+
+  if (options.perform_search) {
+    large_file_searcher = std::make_unique<file_search>(
+        database, scratch, options, scheduler.get());
+  }
 }
 
 directory_search::~directory_search() {
+  // Stop the workers before releasing anything they might use
+  scheduler.reset();
+  large_file_searcher.reset();
+
+  for (auto &state : worker_states) {
+    if (state.glob_scratch) {
+      hs_free_scratch(state.glob_scratch);
+    }
+    if (state.file_type_scratch) {
+      hs_free_scratch(state.file_type_scratch);
+    }
+    if (state.ignore_scratch) {
+      hs_free_scratch(state.ignore_scratch);
+    }
+    if (state.directory_filter_scratch) {
+      hs_free_scratch(state.directory_filter_scratch);
+    }
+    if (state.file_filter_scratch) {
+      hs_free_scratch(state.file_filter_scratch);
+    }
+    state.stream.reset();
+    if (state.scratch) {
+      hs_free_scratch(state.scratch);
+    }
+  }
+
+  if (directory_filter_scratch) {
+    hs_free_scratch(directory_filter_scratch);
+  }
+  if (directory_filter_database) {
+    hs_free_database(directory_filter_database);
+  }
   if (file_filter_scratch) {
     hs_free_scratch(file_filter_scratch);
   }
@@ -20,193 +160,828 @@ directory_search::~directory_search() {
   if (scratch) {
     hs_free_scratch(scratch);
   }
+  delete stream_database;
   if (database) {
     hs_free_database(database);
   }
 }
 
-void directory_search::search_thread_function() {
-  char buffer[FILE_CHUNK_SIZE];
-  std::string lines{};
+void directory_search::run(std::filesystem::path path) {
+  if (!options.ignore_gitindex) {
+    git_libgit2_init();
+  }
+
+  int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd == -1) {
+    return;
+  }
+
+  struct stat root_stat{};
+  if (options.one_file_system || visited_directories ||
+      options.cache_listings) {
+    if (fstat(fd, &root_stat) == -1) {
+      close(fd);
+      return;
+    }
+    root_device = root_stat.st_dev;
+    if (visited_directories) {
+      visited_directories->insert(root_stat.st_dev, root_stat.st_ino);
+    }
+  }
+
+  std::optional<std::string_view> root_entries{};
+  if (options.cache_listings) {
+    cached_listings = std::make_unique<listing_cache>(path);
+    std::string_view entries{};
+    if (cached_listings->find("", root_stat, entries)) {
+      root_entries = entries;
+    }
+  }
+
+  // Globs match the path relative to the root
+  root_path_length = path.native().size();
+  if (root_path_length > 0 && path.native().back() != '/') {
+    root_path_length += 1;
+  }
 
-  hs_scratch_t *local_scratch = NULL;
-  hs_error_t database_error = hs_alloc_scratch(database, &local_scratch);
-  if (database_error != HS_SUCCESS) {
-    throw std::runtime_error("Error allocating scratch space\n");
+  // The scheduler is idle, so the first worker's arena is free to use
+  auto root = worker_states[0].arena.make_directory(nullptr, path.native());
+  root->fd = fd;
+  struct stat device_stat{};
+  if (options.device_limits && fstat(fd, &device_stat) == 0) {
+    root->io_class = options.device_limits->classify(fd, device_stat.st_dev);
   }
+  num_retained_fds += 1;
 
-  moodycamel::ConsumerToken ctok{queue};
+  num_directories_pending = 1;
 
+  // Kick off the directory traversal
+  //
+  // Every directory visited enqueues its files and subdirectories as
+  // more tasks, so once the scheduler is idle the search is complete
+  scheduler->submit([this, root, root_stat, root_entries](
+                        std::size_t worker_index) {
+    visit_directory_and_enqueue(
+        root, worker_index, cached_listings ? &root_stat : nullptr,
+        root_entries);
+  });
+  scheduler->wait();
+
+  if (cached_listings) {
+    cached_listings->save();
+    cached_listings.reset();
+  }
+
+  finish_search();
+}
+
+void directory_search::run_file_list(int fd) {
+  // Listed paths are matched by --glob as they are given
+  root_path_length = 0;
+
+  // Paths are enqueued in batches, one per read from the list, so that
+  // the search starts while the rest of the list is still being read.
+  // Each batch is a nameless directory record that owns its files.
+  path_arena arena{};
+  std::string names{};
+  std::vector<std::uint32_t> offsets{};
+  std::vector<file_node *> nodes{};
+
+  const auto add_path = [&names, &offsets](std::string_view path) {
+    if (!path.empty()) {
+      offsets.push_back(names.size());
+      names += path;
+      names += '\0';
+    }
+  };
+
+  const auto enqueue_batch = [&]() {
+    if (offsets.empty()) {
+      return;
+    }
+    auto batch = arena.make_directory(nullptr, "");
+    batch->files = make_file_block(batch, names, offsets, nodes);
+    batch->num_pending = nodes.size() + 1;
+    for (const auto &file : nodes) {
+      enqueue_listed_file(file);
+    }
+    release_directory(batch);
+    names.clear();
+    offsets.clear();
+  };
+
+  // The list is NUL separated if the first read has a NUL byte,
+  // and newline separated otherwise
+  std::optional<char> separator{};
+  std::string partial_path{};
+  auto buffer = std::make_unique<char[]>(FILE_CHUNK_SIZE);
   while (true) {
-    if (num_files_enqueued > 0) {
-      try_dequeue_and_process_path(ctok, local_scratch, buffer, lines);
+    auto ret = read(fd, buffer.get(), FILE_CHUNK_SIZE);
+    if (ret == -1 && errno == EINTR) {
+      continue;
     }
-    if (!running && num_files_dequeued == num_files_enqueued) {
+    if (ret <= 0) {
       break;
     }
+
+    std::string_view chunk(buffer.get(), ret);
+    if (!separator) {
+      separator = (chunk.find('\0') != std::string_view::npos) ? '\0' : '\n';
+    }
+
+    while (true) {
+      const auto end = chunk.find(*separator);
+      if (end == std::string_view::npos) {
+        partial_path += chunk;
+        break;
+      }
+      if (partial_path.empty()) {
+        add_path(chunk.substr(0, end));
+      } else {
+        partial_path += chunk.substr(0, end);
+        add_path(partial_path);
+        partial_path.clear();
+      }
+      chunk.remove_prefix(end + 1);
+    }
+    enqueue_batch();
   }
+  add_path(partial_path);
+  enqueue_batch();
 
-  hs_free_scratch(local_scratch);
+  scheduler->wait();
+  finish_search();
 }
 
-void directory_search::run(std::filesystem::path path) {
-  if (!options.ignore_gitindex) {
-    git_libgit2_init();
+void directory_search::finish_search() {
+  ordered_queue.clear();
+  ordered_queue_position = 0;
+
+  if (visited_files) {
+    if (options.report_aliases) {
+      visited_files->print_aliases(options.is_stdout);
+    }
+    visited_files->clear();
+    visited_directories->clear();
   }
 
-  std::vector<std::thread> consumer_threads(options.num_threads);
-  if (options.perform_search) {
-    for (std::size_t i = 0; i < options.num_threads; ++i) {
-      consumer_threads[i] = std::thread(
-          std::bind(&directory_search::search_thread_function, this));
+  for (auto &state : worker_states) {
+    state.arena.reset();
+    state.loaded_ignore_rules.clear();
+  }
+}
+
+void directory_search::release_directory(directory_node *directory) {
+  if (--directory->num_pending == 0) {
+    if (directory->fd != -1) {
+      close(directory->fd);
+      directory->fd = -1;
+      num_retained_fds -= 1;
     }
+    delete[] directory->files;
+    directory->files = nullptr;
   }
+}
 
-  // Kick off the directory traversal
-  moodycamel::ProducerToken ptok{queue};
-  visit_directory_and_enqueue(ptok, path.string(), file_filter_scratch);
-
-  // Spawn threads to handle subdirectories
-  {
-    const auto num_subdir_threads = options.num_threads;
-    std::vector<std::thread> traversal_threads(num_subdir_threads);
-    for (std::size_t i = 0; i < num_subdir_threads; ++i) {
-      traversal_threads[i] = std::thread([this]() {
-        // A local scratch for each traversal thread
-        hs_scratch *local_file_filter_scratch{nullptr};
-        if (options.filter_files) {
-          hs_error_t database_error = hs_alloc_scratch(
-              file_filter_database, &local_file_filter_scratch);
-          if (database_error != HS_SUCCESS) {
-            fprintf(stderr, "Error allocating scratch space\n");
-            hs_free_database(file_filter_database);
-            return;
-          }
-        }
+void directory_search::enqueue_directory(directory_node *directory) {
+  num_directories_pending += 1;
+  scheduler->submit([this, directory](std::size_t worker_index) {
+    auto parent = directory->parent;
+    auto &path = worker_states[worker_index].path;
+    path.clear();
+    if (parent->fd == -1 || cached_listings) {
+      append_path(directory, path);
+    }
 
-        while (num_dirs_enqueued > 0) {
-          std::string subdir{};
-          auto found = subdirectories.try_dequeue(subdir);
-          if (found) {
-            if (!options.ignore_gitindex) {
-              const auto dot_git_path = std::filesystem::path(subdir) / ".git";
-              if (std::filesystem::exists(dot_git_path)) {
-                // Enqueue git repo
-                git_repo_paths.enqueue(subdir);
-                ++num_git_repos_enqueued;
-              } else {
-                // go deeper
-                moodycamel::ProducerToken ptok{queue};
-                visit_directory_and_enqueue(ptok, subdir,
-                                            local_file_filter_scratch);
-              }
-            } else {
-              // Ignore git index
-              // Just go deeper
-              moodycamel::ProducerToken ptok{queue};
-              visit_directory_and_enqueue(ptok, subdir,
-                                          local_file_filter_scratch);
-            }
-            num_dirs_enqueued -= 1;
-          }
+    // An unchanged directory is listed from the cache without opening it.
+    // Its entries are then opened by full path.
+    struct stat sb{};
+    if (cached_listings) {
+      std::string_view entries{};
+      const int stat_flags = options.follow_symlinks ? 0 : AT_SYMLINK_NOFOLLOW;
+      if (fstatat(parent->fd != -1 ? parent->fd : AT_FDCWD,
+                  parent->fd != -1 ? directory->name() : path.c_str(), &sb,
+                  stat_flags) == 0 &&
+          S_ISDIR(sb.st_mode) &&
+          cached_listings->find(
+              std::string_view(path).substr(
+                  std::min(path.size(), root_path_length)),
+              sb, entries)) {
+        release_directory(parent);
+        if (visited_directories &&
+            !visited_directories->insert(sb.st_dev, sb.st_ino)) {
+          finish_directory_visit();
+          return;
         }
+        visit_directory_and_enqueue(directory, worker_index, &sb, entries);
+        return;
+      }
+    }
 
-        if (local_file_filter_scratch) {
-          hs_free_scratch(local_file_filter_scratch);
-        }
-      });
+    // Opening a directory reads its parent, so it holds a slot of the
+    // parent's class, which the directory has inherited
+    const int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC |
+                      (options.follow_symlinks ? 0 : O_NOFOLLOW);
+    int fd{-1};
+    {
+      const auto slot =
+          options.device_limits
+              ? options.device_limits->acquire(directory->io_class)
+              : io_concurrency::slot{};
+      if (parent->fd != -1) {
+        fd = openat(parent->fd, directory->name(), flags);
+      } else {
+        fd = open(path.c_str(), flags);
+      }
     }
 
-    for (std::size_t i = 0; i < num_subdir_threads; ++i) {
-      traversal_threads[i].join();
+    // Release the parent (and maybe its fd) as early as possible
+    release_directory(parent);
+
+    if (fd == -1) {
+      finish_directory_visit();
+      return;
+    }
+
+    // A directory seen before is either a symlink cycle
+    // or another path (symlink, bind mount) to the same tree
+    //
+    // With --listing-cache, this stat is stored with the listing
+    if (visited_directories || cached_listings) {
+      if (fstat(fd, &sb) == -1 ||
+          (visited_directories &&
+           !visited_directories->insert(sb.st_dev, sb.st_ino))) {
+        close(fd);
+        finish_directory_visit();
+        return;
+      }
+      if (options.device_limits) {
+        directory->io_class = options.device_limits->classify(fd, sb.st_dev);
+      }
     }
+    directory->fd = fd;
+    num_retained_fds += 1;
+    visit_directory_and_enqueue(directory, worker_index,
+                                cached_listings ? &sb : nullptr);
+  });
+}
+
+void directory_search::enqueue_file(file_node *file) {
+  scheduler->submit([this, file](std::size_t worker_index) {
+    process_file(file, worker_states[worker_index], nullptr);
+    release_directory(file->parent);
+  });
+}
+
+void directory_search::enqueue_files(std::vector<file_node *> &&files) {
+  scheduler->submit([this, files = std::move(files)](std::size_t worker_index) {
+    auto &state = worker_states[worker_index];
+    for (const auto &file : files) {
+      if (!process_file(file, state, state.batch.get())) {
+        release_directory(file->parent);
+      }
+    }
+    search_batch(state);
+  });
+}
+
+void directory_search::enqueue_listed_file(file_node *file) {
+  scheduler->submit([this, file](std::size_t worker_index) {
+    if (filter_listed_file(file, worker_index)) {
+      process_file(file, worker_states[worker_index], nullptr);
+    }
+    release_directory(file->parent);
+  });
+}
+
+bool directory_search::filter_listed_file(const file_node *file,
+                                          std::size_t worker_index) {
+  auto &state = worker_states[worker_index];
+  const char *path = file->name();
+  const std::size_t length = file->name_length;
+
+  if (!options.file_types->accept(path, length, state.file_type_scratch)) {
+    return false;
   }
 
-  running = false;
+  if (options.globs) {
+    // Globs don't expect a leading "./"
+    std::size_t offset{0};
+    while (length - offset > 2 && path[offset] == '.' &&
+           path[offset + 1] == '/') {
+      offset += 2;
+    }
+    if (!options.globs->accept(path + offset, length - offset,
+                               state.glob_scratch)) {
+      return false;
+    }
+  }
 
-  // Done enqueuing files for search
+  if (options.filter_files &&
+      !filter_file(path, length, file_filter_database,
+                   state.file_filter_scratch, options.negate_filter)) {
+    return false;
+  }
 
-  // Help with the search now:
-  if (options.perform_search) {
-    search_thread_function();
+  // Unlike a directory listing, the list may name anything
+  struct stat sb;
+  if (stat(path, &sb) == -1) {
+    std::cerr << path << ": " << std::strerror(errno) << " (os error "
+              << errno << ")\n";
+    return false;
+  }
+  if (!S_ISREG(sb.st_mode) || (options.max_file_size.has_value() &&
+                               static_cast<std::size_t>(sb.st_size) >
+                                   options.max_file_size.value())) {
+    return false;
+  }
 
-    for (std::size_t i = 0; i < options.num_threads; ++i) {
-      consumer_threads[i].join();
+  // With --shard, only large files are searched in every shard,
+  // each shard scanning its own chunks
+  const std::size_t file_size = sb.st_size;
+  const bool is_large_file =
+      options.perform_search && file_size > LARGE_FILE_SIZE;
+  std::string shard_path{};
+  if (options.shard) {
+    // See inode_shard_key
+    shard_path = visited_files ? inode_shard_key(sb.st_ino)
+                               : std::string(path, length);
+    if (!is_large_file && !in_shard(*options.shard, shard_path)) {
+      return false;
     }
   }
 
-  // All threads are done processing the file queue
+  if (!options.perform_search) {
+    if (options.is_stdout) {
+      fmt::print(fg(fmt::color::steel_blue), "{}\n", path);
+    } else {
+      fmt::print("{}\n", path);
+    }
+    return false;
+  }
+
+  // The size is known, so a large file goes straight to file_search
+  // instead of being read in chunks first
+  if (is_large_file) {
+    if (visited_files && !visited_files->insert(sb.st_dev, sb.st_ino, path)) {
+      return false;
+    }
+    scheduler->submit([this, path = std::string(path, length), file_size,
+                       shard_path = std::move(shard_path)](
+                          std::size_t) mutable {
+      large_file_searcher->run(std::move(path), file_size,
+                               std::move(shard_path));
+    });
+    return false;
+  }
+  return true;
+}
 
-  // Search git repos one by one
-  if (!options.ignore_gitindex && num_git_repos_enqueued > 0) {
-    auto current_path = std::filesystem::current_path();
+void directory_search::finish_directory_visit() {
+  if (--num_directories_pending == 0 &&
+      options.read_order != file_read_order::traversal) {
+    // The traversal is done, whatever is left forms the last batch
+    std::lock_guard<std::mutex> lock(ordered_mutex);
+    cut_ordered_batch(true);
+    start_ordered_readers();
+  }
+}
 
-    while (num_git_repos_enqueued > 0) {
-      std::string repo_path{};
-      auto found = git_repo_paths.try_dequeue(repo_path);
+void directory_search::enqueue_ordered_files(directory_node *directory,
+                                             std::size_t worker_index) {
+  auto &state = worker_states[worker_index];
+
+  // Find the sort keys before taking the lock
+  auto &files = state.ordered_files;
+  files.clear();
+  for (std::size_t i = 0; i < state.file_nodes.size(); ++i) {
+    auto file = state.file_nodes[i];
+    std::uint64_t key = name_inode(state.names, state.file_offsets[i]);
+
+    if (options.read_order == file_read_order::extent) {
+      // Keep the inode number if there is no extent to go by
+      std::uint64_t offset{0};
+      bool found{false};
+      if (directory->fd != -1) {
+        found = first_physical_offset(directory->fd, file->name(), offset);
+      } else {
+        auto &path = state.path;
+        path.clear();
+        append_path(file, path);
+        found = first_physical_offset(AT_FDCWD, path.c_str(), offset);
+      }
       if (found) {
+        key = offset;
+      }
+    }
 
-        git_index_search git_index_searcher(
-            database, scratch, file_filter_database, file_filter_scratch,
-            options, repo_path);
-        if (chdir(repo_path.c_str()) == 0) {
-          git_index_searcher.run(".");
-          if (chdir(current_path.c_str()) != 0) {
-            throw std::runtime_error("Failed to restore path");
-          }
-        }
+    files.push_back(ordered_file{key, file});
+  }
 
-        --num_git_repos_enqueued;
+  std::lock_guard<std::mutex> lock(ordered_mutex);
+  ordered_batch.insert(ordered_batch.end(), files.begin(), files.end());
+  cut_ordered_batch(false);
+  start_ordered_readers();
+}
+
+bool directory_search::cut_ordered_batch(bool force) {
+  // Called with ordered_mutex held
+  //
+  // The next batch is only cut once the readers are done with the
+  // current one, so that each batch is read in a single sweep
+  if (ordered_queue_position < ordered_queue.size() || ordered_batch.empty()) {
+    return false;
+  }
+
+  // Wait for a larger batch (i.e., a better order) while many
+  // directories are still to be listed
+  const auto batch_size = std::clamp(
+      num_directories_pending.load() * ORDERED_BATCH_SIZE_PER_DIRECTORY,
+      MIN_ORDERED_BATCH_SIZE, MAX_ORDERED_BATCH_SIZE);
+  if (!force && ordered_batch.size() < batch_size) {
+    return false;
+  }
+
+  std::stable_sort(
+      ordered_batch.begin(), ordered_batch.end(),
+      [](const ordered_file &a, const ordered_file &b) { return a.key < b.key; });
+  ordered_queue.swap(ordered_batch);
+  ordered_batch.clear();
+  ordered_queue_position = 0;
+  return true;
+}
+
+void directory_search::start_ordered_readers() {
+  // Called with ordered_mutex held
+  const auto max_readers =
+      std::min(MAX_ORDERED_READERS, scheduler->num_workers());
+  while (num_ordered_readers < max_readers &&
+         ordered_queue_position < ordered_queue.size()) {
+    num_ordered_readers += 1;
+    scheduler->submit([this](std::size_t worker_index) {
+      read_ordered_files(worker_index);
+    });
+  }
+}
+
+void directory_search::read_ordered_files(std::size_t worker_index) {
+  auto &state = worker_states[worker_index];
+  while (true) {
+    file_node *file{nullptr};
+    {
+      std::lock_guard<std::mutex> lock(ordered_mutex);
+      if (ordered_queue_position == ordered_queue.size() &&
+          !cut_ordered_batch(num_directories_pending == 0)) {
+        num_ordered_readers -= 1;
+        break;
       }
+      file = ordered_queue[ordered_queue_position++].file;
+    }
+
+    if (!process_file(file, state, state.batch.get())) {
+      release_directory(file->parent);
     }
   }
+  search_batch(state);
+}
 
-  if (options.perform_search) {
-    // Now search large files one by one using the large_file_searcher
-    if (num_large_files_enqueued > 0) {
-      file_search large_file_searcher(database, scratch, options);
-
-      // Memory map + multi-threaded search
-      while (num_large_files_enqueued > 0) {
-        large_file lf{};
-        auto found = large_file_backlog.try_dequeue(lf);
-        if (found) {
-          large_file_searcher.run(lf.path, lf.size);
-          --num_large_files_enqueued;
-        }
+void directory_search::print_files(directory_node *directory,
+                                   std::size_t worker_index) {
+  auto &state = worker_states[worker_index];
+
+  // If --max-filesize is used, perform a stat
+  // and check if the file size is under the limit
+  static const bool max_file_size_provided = options.max_file_size.has_value();
+  static const std::size_t max_file_size =
+      max_file_size_provided ? options.max_file_size.value() : 0;
+
+  auto &path = state.path;
+  path.clear();
+  append_path(directory, path);
+  if (!path.empty() && path.back() != '/') {
+    path += '/';
+  }
+  const auto directory_path_length = path.size();
+
+  for (const auto &offset : state.file_offsets) {
+    const char *name = &state.names[offset];
+
+    if (max_file_size_provided) {
+      path.resize(directory_path_length);
+      path += name;
+
+      struct stat sb;
+      if (fstatat(directory->fd != -1 ? directory->fd : AT_FDCWD,
+                  directory->fd != -1 ? name : path.c_str(), &sb, 0) == -1 ||
+          static_cast<std::size_t>(sb.st_size) > max_file_size) {
+        // skip this file
+        continue;
       }
     }
+
+    path.resize(directory_path_length);
+    path += name;
+    if (options.shard &&
+        !in_shard(*options.shard,
+                  std::string_view(path).substr(root_path_length))) {
+      continue;
+    }
+    if (options.is_stdout) {
+      fmt::print(fg(fmt::color::steel_blue), "{}\n", path);
+    } else {
+      fmt::print("{}\n", path);
+    }
   }
 }
 
-bool is_blacklisted(const std::string &str) {
-  const std::vector<std::string> substrings{".o",    ".so",  ".png", ".jpg",
-                                            ".jpeg", ".mp3", ".mp4", ".gz",
-                                            ".xz",   ".zip"};
+bool directory_search::prune_directory(directory_node *parent,
+                                       const char *name,
+                                       std::size_t worker_index) {
+  // Entries of a directory at depth d + 1 are at depth d + 2
+  if (options.max_depth.has_value() &&
+      parent->depth + 2 > options.max_depth.value()) {
+    return true;
+  }
+
+  auto &path = worker_states[worker_index].path;
+  path.clear();
+  const auto build_path = [parent, name, &path]() {
+    if (path.empty()) {
+      append_path(parent, path);
+      if (!path.empty() && path.back() != '/') {
+        path += '/';
+      }
+      path += name;
+    }
+  };
+
+  if (options.one_file_system) {
+    if (parent->fd == -1) {
+      build_path();
+    }
+
+    // Don't trigger an automount just to find out it's another filesystem
+    // With -L, the target of a symlink is what matters
+    const int flags = AT_NO_AUTOMOUNT |
+                      (options.follow_symlinks ? 0 : AT_SYMLINK_NOFOLLOW);
+    struct stat sb;
+    if (fstatat(parent->fd != -1 ? parent->fd : AT_FDCWD,
+                parent->fd != -1 ? name : path.c_str(), &sb, flags) == -1 ||
+        sb.st_dev != root_device) {
+      return true;
+    }
+  }
 
-  for (const auto &substring : substrings) {
-    if (str.size() >= substring.size() &&
-        str.compare(str.size() - substring.size(), substring.size(),
-                    substring) == 0) {
+  if (directory_filter_database) {
+    build_path();
+    if (exclude_directory(path.data(), path.size(), directory_filter_database,
+                          worker_states[worker_index]
+                              .directory_filter_scratch)) {
       return true;
     }
   }
+
   return false;
 }
 
-bool directory_search::process_file(std::string &&filename,
-                                    hs_scratch_t *local_scratch, char *buffer,
-                                    std::string &lines) {
+void directory_search::apply_ignore_rules(directory_node *directory,
+                                          std::uint32_t ignore_files,
+                                          std::size_t worker_index) {
+  auto &state = worker_states[worker_index];
+  auto &names = state.names;
+
+  auto &path = state.path;
+  path.clear();
+  append_path(directory, path);
+  if (!path.empty() && path.back() != '/') {
+    path += '/';
+  }
+  const auto directory_path_length = path.size();
+
+  // Rules of this directory apply on top of the inherited ones
+  if (ignore_files != 0) {
+    auto rules =
+        std::make_unique<ignore_rules>(directory->ignore, directory_path_length);
+    for (std::size_t i = 0; i < ignore_rules::NUM_FILE_NAMES; ++i) {
+      if (ignore_files & (1u << i)) {
+        rules->add_file(directory->fd, i);
+      }
+    }
+    if (rules->compile(path)) {
+      directory->ignore = rules.get();
+      state.loaded_ignore_rules.push_back(std::move(rules));
+    }
+  }
 
-  if (is_blacklisted(filename)) {
-    return false;
+  const auto rules = directory->ignore;
+  if (!rules || !rules->alloc_scratch(&state.ignore_scratch)) {
+    return;
   }
 
-  int fd = open(filename.data(), O_RDONLY, 0);
-  if (fd == -1) {
+  const auto keep = [&](std::vector<std::uint32_t> &offsets,
+                        bool is_directory) {
+    std::size_t num_kept{0};
+    for (const auto &offset : offsets) {
+      path.resize(directory_path_length);
+      path += &names[offset];
+      if (!rules->is_ignored(path, is_directory, state.ignore_scratch)) {
+        offsets[num_kept++] = offset;
+      }
+    }
+    offsets.resize(num_kept);
+  };
+  keep(state.subdirectory_offsets, true);
+  keep(state.file_offsets, false);
+}
+
+void directory_search::visit_git_repo(directory_node *directory,
+                                      std::size_t worker_index) {
+  auto &state = worker_states[worker_index];
+
+  // Paths from the index are relative to the current directory.
+  // Store them relative to this directory instead, so that they are
+  // opened with openat() like any other file
+  auto &path = state.path;
+  path.clear();
+  append_path(directory, path);
+  if (!path.empty() && path.back() != '/') {
+    path += '/';
+  }
+  const auto prefix_length = path.size();
+
+  git_index_search git_index_searcher(
+      database, stream_database, scratch, file_filter_database,
+      state.file_filter_scratch, options, std::string_view(path));
+  git_index_searcher.prune_directories(directory_filter_database,
+                                       state.directory_filter_scratch,
+                                       directory->depth, root_device);
+  git_index_searcher.enumerate([&state, prefix_length](std::string &&path) {
+    const auto offset =
+        path.size() > prefix_length ? prefix_length : std::size_t{0};
+    state.file_offsets.push_back(state.names.size());
+    // The index has no inode numbers, these files keep the index order
+    append_name(state.names, std::string_view(path).substr(offset), 0);
+  });
+}
+
+bool directory_search::process_file(const file_node *file,
+                                    worker_state &state, file_batch *batch) {
+  // Only built once there is something to print
+  auto &filename = state.filename;
+  filename.clear();
+  const auto build_filename = [file, &filename]() {
+    if (filename.empty()) {
+      append_path(file, filename);
+    }
+  };
+
+  const auto report_error = [&]() {
+    build_filename();
     std::cerr << filename << ": " << std::strerror(errno) << " (os error " << errno << ")\n";
+  };
+
+  // The size decides how the file is read, so it is known up front.
+  // With --max-filesize, it is checked before the file is even opened.
+  struct stat file_stat{};
+  const bool max_file_size_provided = options.max_file_size.has_value();
+  if (max_file_size_provided) {
+    if (file->parent->fd == -1) {
+      build_filename();
+    }
+    if (fstatat(file->parent->fd != -1 ? file->parent->fd : AT_FDCWD,
+                file->parent->fd != -1 ? file->name() : filename.data(),
+                &file_stat, 0) == -1) {
+      report_error();
+      return false;
+    }
+    if (static_cast<std::size_t>(file_stat.st_size) >
+        options.max_file_size.value()) {
+      return false;
+    }
+  }
+
+  int fd{-1};
+  if (file->parent->fd != -1) {
+    fd = openat(file->parent->fd, file->name(), O_RDONLY, 0);
+  } else {
+    build_filename();
+    fd = open(filename.data(), O_RDONLY, 0);
+  }
+  if (fd == -1) {
+    report_error();
     return false;
   }
+
+  if (!max_file_size_provided && fstat(fd, &file_stat) == -1) {
+    report_error();
+    close(fd);
+    return false;
+  }
+  const std::size_t file_size = file_stat.st_size;
+
+  // With --shard, a large file is searched by every shard, each scanning
+  // its own chunks, and a small file by one shard only. This is decided
+  // before the inode is deduplicated, see inode_shard_key.
+  std::string shard_path{};
+  if (options.shard) {
+    if (visited_files) {
+      shard_path = inode_shard_key(file_stat.st_ino);
+    } else {
+      build_filename();
+      shard_path =
+          filename.substr(std::min(filename.size(), root_path_length));
+    }
+    if (file_size <= LARGE_FILE_SIZE &&
+        !in_shard(*options.shard, shard_path)) {
+      close(fd);
+      return false;
+    }
+  }
+
+  // Search each inode only once, however many paths lead to it
+  if (visited_files) {
+    if (options.report_aliases) {
+      build_filename();
+    }
+    if (!visited_files->insert(file_stat.st_dev, file_stat.st_ino,
+                               filename)) {
+      close(fd);
+      return false;
+    }
+  }
+
+  // A large file is memory mapped and searched in parallel chunks, by
+  // tasks on the same scheduler
+  if (file_size > LARGE_FILE_SIZE) {
+    close(fd);
+    build_filename();
+    scheduler->submit([this, path = filename, file_size,
+                       shard_path = std::move(shard_path)](
+                          std::size_t) mutable {
+      large_file_searcher->run(std::move(path), file_size,
+                               std::move(shard_path));
+    });
+    return false;
+  }
+
+  // A tiny file waits in the batch, see search_batch
+  if (batch && file_size <= TINY_FILE_SIZE) {
+    if (!batch->has_room(file_size)) {
+      // The batch leaves the name of one of its files behind
+      search_batch(state);
+      filename.clear();
+    }
+    if (batch->read_file(fd, file, file_stat)) {
+      state.batched_files.push_back(file);
+      close(fd);
+      return true;
+    }
+  }
+
+  // Anything more than a chunk is read front to back
+  if (file_size > FILE_CHUNK_SIZE) {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  }
+
+  search_file(file, fd, {}, file_stat, state);
+  close(fd);
+  return false;
+}
+
+void directory_search::search_batch(worker_state &state) {
+  if (!state.batch || state.batch->empty()) {
+    return;
+  }
+  state.batch->scan(
+      database, state.scratch,
+      [this, &state](const void *file, const struct stat &file_stat,
+                     std::string_view data) {
+        state.filename.clear();
+        search_file(static_cast<const file_node *>(file), -1, data, file_stat,
+                    state);
+      });
+  for (const auto &file : state.batched_files) {
+    release_directory(file->parent);
+  }
+  state.batched_files.clear();
+}
+
+bool directory_search::search_file(const file_node *file, int fd,
+                                   std::string_view first_read,
+                                   const struct stat &file_stat,
+                                   worker_state &state) {
+  auto &filename = state.filename;
+  const auto build_filename = [file, &filename]() {
+    if (filename.empty()) {
+      append_path(file, filename);
+    }
+  };
+  auto &lines = state.lines;
+  auto &reader = *state.reader;
+  auto local_scratch = state.scratch;
+  auto &stream = *state.stream;
+  const std::size_t file_size = file_stat.st_size;
+
   bool result{false};
 
   const auto process_fn =
@@ -216,112 +991,50 @@ bool directory_search::process_file(std::string &&filename,
           : process_matches_nocolor_nostdout;
 
   // Process the file in chunks
-  std::size_t total_bytes_read = 0;
-  bool max_file_size_provided = options.max_file_size.has_value();
-  std::size_t max_file_size =
-      max_file_size_provided ? options.max_file_size.value() : 0;
-  std::size_t bytes_read = 0;
   std::atomic<std::size_t> max_line_number{0};
   std::size_t current_line_number{1};
   std::size_t num_matching_lines{0};
   std::size_t num_matches{0};
 
   // Read the file in chunks and perform search
+  // The stream carries matches across chunks, and across the pieces of a
+  // long line
+  reader.reset(fd, first_read, file_size,
+               fd != -1 ? options.device_limits->classify(fd, file_stat.st_dev)
+                        : device_class::local);
+  stream.reset();
+  std::string_view chunk{};
+  long_line_matches long_line{};
   bool first{true};
-  bool continue_even_though_large_file{false};
   while (true) {
 
-    auto ret = read(fd, buffer, FILE_CHUNK_SIZE);
-
-    if (ret > 0) {
-      bytes_read = ret;
-    } else {
+    const auto status = reader.next(chunk);
+    if (status == chunk_reader::status::end_of_file) {
       break;
     }
 
-    total_bytes_read += bytes_read;
-
-    if (max_file_size_provided && total_bytes_read > max_file_size) {
-      // File size limit reached
-      close(fd);
-      lines.clear();
-      return false;
-    } else if (!continue_even_though_large_file &&
-               total_bytes_read > LARGE_FILE_SIZE) {
-      // This file is a bit large
-      // Add it to the backlog and process it later with a file_search object
-      // instead of using a single thread to read in chunks
-      // The file_search object will memory map and search this large file
-      // in multiple threads
-
-      // Perform a stat and check the file size?
-      // If the file size is not much larger than total_bytes_read
-      // just continue and finish the file
-      const auto file_size = std::filesystem::file_size(filename.data());
-
-      // Only bail if the file size if more than twice of
-      // what hypergrep has already searched
-      if (total_bytes_read * 2 > file_size) {
-
-        large_file lf{std::move(filename), file_size};
-
-        large_file_backlog.enqueue(lf);
-        ++num_large_files_enqueued;
-        close(fd);
-        lines.clear();
-        return false;
-      } else {
-        continue_even_though_large_file = true;
-      }
-    }
-
     if (first) {
       first = false;
-      if (starts_with_magic_bytes(buffer, bytes_read)) {
+      if (starts_with_magic_bytes(chunk.data(), chunk.size())) {
         result = false;
         break;
       }
 
-      if (has_null_bytes(buffer, bytes_read)) {
+      if (has_null_bytes(chunk.data(), chunk.size())) {
         // NULL bytes found
         // Ignore file
         // Could be a .exe, .gz, .bin etc.
         result = false;
         break;
       }
-    } else if (first) {
-      first = false;
-    }
-
-    // Detect end of file
-    // If end of file, search entire chunk
-    // If not end of file, search for last newline
-    const auto last_chunk = (bytes_read < FILE_CHUNK_SIZE);
-    std::size_t search_size = bytes_read;
-
-    char *last_newline = buffer + bytes_read;
-    if (!last_chunk) {
-      // Find the position of the last newline in the buffer
-      // In order to catch matches between chunks, need to amend the buffer
-      // and make sure it stops at a new line boundary
-      char *last_newline = (char *)memrchr(buffer, '\n', bytes_read);
-      if (last_newline) {
-        search_size = last_newline - buffer;
-      } else {
-        // Not a single newline in the entire chunk
-        // This could be some binary file or some minified JS file
-        // Skip it
-        result = false;
-        break;
-      }
     }
 
     std::vector<std::pair<unsigned long long, unsigned long long>> matches{};
     std::atomic<size_t> number_of_matches = 0;
     file_context ctx{number_of_matches, matches, options.print_only_filenames};
 
-    if (hs_scan(database, buffer, search_size, 0, local_scratch, on_match,
-                (void *)(&ctx)) != HS_SUCCESS) {
+    if (stream.scan(local_scratch, chunk, reader.chunk_offset(),
+                    reader.done(), ctx) != HS_SUCCESS) {
       if (options.print_only_filenames && ctx.number_of_matches > 0) {
         result = true;
       } else {
@@ -334,43 +1047,49 @@ bool directory_search::process_file(std::string &&filename,
       }
     }
 
-    if (ctx.number_of_matches > 0) {
+    const std::size_t chunk_line_number = current_line_number;
+    if (status == chunk_reader::status::line_piece) {
+      long_line.add_piece(chunk, chunk_line_number, ctx.number_of_matches);
+      num_matches += ctx.number_of_matches;
+    } else if (long_line.in_line) {
+      if (long_line.has_matches()) {
+        build_filename();
+      }
+      num_matching_lines +=
+          long_line.finish(lines, filename.data(), options.print_filenames,
+                           options.is_stdout, options.show_line_numbers);
+    }
+
+    if (status == chunk_reader::status::chunk && ctx.number_of_matches > 0) {
+      build_filename();
       num_matching_lines += process_fn(
-          filename.data(), buffer, search_size, ctx.matches,
-          current_line_number, lines, options.print_filenames,
+          filename.data(), chunk.data(), chunk.size(),
+          ctx.matches, current_line_number, lines, options.print_filenames,
           options.is_stdout, options.show_line_numbers,
           options.show_column_numbers, options.show_byte_offset,
           options.print_only_matching_parts, options.max_column_limit,
-          total_bytes_read - bytes_read, options.ltrim_each_output_line);
+          reader.chunk_offset(), options.ltrim_each_output_line);
       num_matches += ctx.number_of_matches;
     }
 
-    if (!last_chunk) {
-
-      if (static_cast<std::size_t>(last_newline - buffer) == bytes_read - 1) {
-        // Chunk ends exactly at the newline
-        // Do nothing
-      } else {
-        // Backtrack "remainder" number of characters
-        if (bytes_read > search_size) {
-          if ((bytes_read - search_size) < FILE_CHUNK_SIZE) {
-            lseek(fd, -1 * (bytes_read - search_size), SEEK_CUR);
-          } else {
-            // Don't lseek back the entire chunk
-            // because that's an infinite loop
-
-            // Not a single newline in the entire chunk
-            // This could be some binary file or some minified JS file
-            // Skip it
-            result = false;
-            break;
-          }
-        }
-      }
+    // The next chunk starts where this one ended, not at the last match
+    if (options.show_line_numbers) {
+      current_line_number =
+          chunk_line_number + std::count(chunk.begin(), chunk.end(), '\n');
     }
   }
 
-  close(fd);
+  // The file may end with a long line
+  if (long_line.has_matches()) {
+    build_filename();
+  }
+  num_matching_lines +=
+      long_line.finish(lines, filename.data(), options.print_filenames,
+                       options.is_stdout, options.show_line_numbers);
+
+  if (result || options.count_include_zeros) {
+    build_filename();
+  }
 
   if ((result || options.count_include_zeros) && options.count_matching_lines &&
       !options.print_only_filenames) {
@@ -422,104 +1141,254 @@ bool directory_search::process_file(std::string &&filename,
     }
   }
 
+  if (result && visited_files) {
+    visited_files->mark_matched(file_stat.st_dev, file_stat.st_ino);
+  }
+
   lines.clear();
   return result;
 }
 
 void directory_search::visit_directory_and_enqueue(
-    moodycamel::ProducerToken &ptok, std::string directory,
-    hs_scratch *local_file_filter_scratch) {
-  DIR *dir = opendir(directory.c_str());
-  if (dir == NULL) {
-    return;
+    directory_node *directory, std::size_t worker_index,
+    const struct stat *directory_stat,
+    std::optional<std::string_view> cached_entries) {
+  auto &state = worker_states[worker_index];
+  auto &names = state.names;
+  auto &subdirectory_offsets = state.subdirectory_offsets;
+  auto &file_offsets = state.file_offsets;
+  names.clear();
+  subdirectory_offsets.clear();
+  file_offsets.clear();
+
+  // List the whole directory first: a `.git` entry anywhere in the
+  // listing turns this directory into a git repository search
+  bool is_git_repo{false};
+  std::uint32_t ignore_files{0};
+
+  // With --listing-cache, a directory read from disk has its complete
+  // listing recorded, with the entry types resolved below
+  auto &listing = state.listing;
+  listing.clear();
+  const bool record_listing = directory_stat && !cached_entries;
+  std::size_t type_offset{0};
+
+  directory_reader reader(directory->fd, state.directory_buffer.get(),
+                          DIRECTORY_BUFFER_SIZE);
+  cached_listing_reader cached_reader(cached_entries.value_or(""));
+  const auto next_entry = [&](directory_entry &entry) {
+    if (cached_entries) {
+      return cached_reader.next(entry);
+    }
+    if (!reader.next(entry)) {
+      return false;
+    }
+    if (record_listing) {
+      type_offset = listing_cache::append_entry(listing, entry);
+    }
+    return true;
+  };
+
+  // A directory listed from the cache isn't open. Its entries are
+  // resolved by full path.
+  const auto resolve_type = [&](const char *name, bool follow_symlinks) {
+    if (directory->fd != -1) {
+      return resolve_entry_type(directory->fd, name, follow_symlinks);
+    }
+    auto &path = state.path;
+    path.clear();
+    append_path(directory, path);
+    path += '/';
+    path += name;
+    return resolve_entry_type(AT_FDCWD, path.c_str(), follow_symlinks);
+  };
+
+  // A directory read from disk holds a slot of its class while it is
+  // listed, for the getdents64 calls and the fstatat of DT_UNKNOWN entries
+  std::optional<io_concurrency::slot> listing_slot{};
+  if (options.device_limits && !cached_entries) {
+    listing_slot.emplace(options.device_limits->acquire(directory->io_class));
   }
 
-  struct dirent *entry;
-  while (true) {
-    entry = readdir(dir);
-    if (!entry) {
-      break;
+  directory_entry entry{};
+  while (next_entry(entry)) {
+    const char *name = entry.name;
+
+    if (name[0] == '.') {
+      // Always skip these two
+      if (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')) {
+        continue;
+      }
+
+      if (!options.ignore_gitindex && strcmp(name, ".git") == 0) {
+        is_git_repo = true;
+        break;
+      }
+
+      if (options.respect_ignore_files) {
+        const auto index = ignore_rules::file_index(name);
+        if (index < ignore_rules::NUM_FILE_NAMES) {
+          ignore_files |= (1u << index);
+        }
+      }
+
+      // Ignore dot files/directories unless requested
+      if (!options.search_hidden_files) {
+        continue;
+      }
     }
 
-    // Ignore symlinks
-    if (entry->d_type == DT_LNK) {
-      continue;
+    auto type = entry.type;
+    if (type == DT_UNKNOWN) {
+      type = resolve_type(name, false);
+      if (record_listing) {
+        listing[type_offset] = static_cast<char>(type);
+      }
+    }
+    if (type == DT_LNK && options.follow_symlinks) {
+      type = resolve_type(name, true);
     }
 
-    // Ignore dot files/directories unless requested
-    if (!options.search_hidden_files && entry->d_name[0] == '.')
+    // Ignore symlinks, unless followed above
+    if (type == DT_DIR) {
+      subdirectory_offsets.push_back(names.size());
+    } else if (type == DT_REG) {
+      if (!options.file_types->accept(name, strlen(name),
+                                      state.file_type_scratch)) {
+        continue;
+      }
+      file_offsets.push_back(names.size());
+    } else {
       continue;
+    }
+    append_name(names, name, entry.inode);
+  }
+  listing_slot.reset();
+
+  if (record_listing && !is_git_repo) {
+    auto &path = state.path;
+    path.clear();
+    append_path(directory, path);
+    cached_listings->store(
+        std::string_view(path).substr(std::min(path.size(), root_path_length)),
+        *directory_stat, listing);
+  }
+
+  // Ignore files are read relative to the directory
+  if (directory->fd == -1 && ignore_files != 0 && !is_git_repo) {
+    auto &path = state.path;
+    path.clear();
+    append_path(directory, path);
+    directory->fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (directory->fd != -1) {
+      num_retained_fds += 1;
+    }
+  }
 
-    // Check if the entry is a directory
-    if (entry->d_type == DT_DIR) {
+  if (is_git_repo) {
+    names.clear();
+    subdirectory_offsets.clear();
+    file_offsets.clear();
+    visit_git_repo(directory, worker_index);
+  } else if (ignore_files != 0 || directory->ignore) {
+    // Ignored directories are dropped here, before they are ever opened
+    apply_ignore_rules(directory, ignore_files, worker_index);
+  }
 
-      if (options.search_hidden_files) {
-        // Even if hidden files are going to be searched
-        // Need to skip these two
-        if (strcmp(entry->d_name, ".") == 0 ||
-            strcmp(entry->d_name, "..") == 0) {
-          continue;
-        }
+  // Prune whole subtrees before they are ever opened
+  if (!subdirectory_offsets.empty() &&
+      (options.max_depth.has_value() || options.one_file_system ||
+       directory_filter_database)) {
+    std::size_t num_kept{0};
+    for (const auto &offset : subdirectory_offsets) {
+      if (!prune_directory(directory, &names[offset], worker_index)) {
+        subdirectory_offsets[num_kept++] = offset;
       }
+    }
+    subdirectory_offsets.resize(num_kept);
+  }
 
-      // Enqueue subdirectory for processing
-      const auto path = std::filesystem::path{directory} / entry->d_name;
-      subdirectories.enqueue(std::move(path));
-      num_dirs_enqueued += 1;
-    } else if (entry->d_type == DT_REG) {
-      const auto path = std::filesystem::path{directory} / entry->d_name;
-
-      if (!options.filter_files ||
-          (options.filter_files &&
-           filter_file(path.c_str(), file_filter_database,
-                       local_file_filter_scratch, options.negate_filter))) {
-        if (options.perform_search) {
-          queue.enqueue(ptok, std::move(path));
-          ++num_files_enqueued;
-        } else {
+  if (options.max_depth.has_value() &&
+      directory->depth + 1 > options.max_depth.value()) {
+    file_offsets.clear();
+  }
 
-          // If --max-filesize is used, perform a stat
-          // and check if the file size is under the limit
-          static const bool max_file_size_provided =
-              options.max_file_size.has_value();
-          static const std::size_t max_file_size =
-              max_file_size_provided ? options.max_file_size.value() : 0;
-
-          if (max_file_size_provided) {
-
-            const auto file_size = std::filesystem::file_size(path);
-            if (file_size > max_file_size) {
-              // skip this file
-              continue;
-            }
-          }
-
-          if (options.is_stdout) {
-            fmt::print(fg(fmt::color::steel_blue), "{}\n", path.c_str());
-          } else {
-            fmt::print("{}\n", path.c_str());
-          }
-        }
+  // --filter is already applied to the entries of a git index, --glob
+  // is applied here to all files since it needs the path from the root
+  const bool apply_filter = !is_git_repo && options.filter_files;
+  if ((apply_filter || options.globs) && !file_offsets.empty()) {
+    auto &path = state.path;
+    path.clear();
+    append_path(directory, path);
+    if (!path.empty() && path.back() != '/') {
+      path += '/';
+    }
+    const auto directory_path_length = path.size();
+
+    auto local_file_filter_scratch = state.file_filter_scratch;
+    std::size_t num_kept{0};
+    for (const auto &offset : file_offsets) {
+      path.resize(directory_path_length);
+      path += &names[offset];
+      if (apply_filter &&
+          !filter_file(path.data(), path.size(), file_filter_database,
+                       local_file_filter_scratch, options.negate_filter)) {
+        continue;
+      }
+      if (options.globs &&
+          !options.globs->accept(path.data() + root_path_length,
+                                 path.size() - root_path_length,
+                                 state.glob_scratch)) {
+        continue;
       }
+      file_offsets[num_kept++] = offset;
     }
+    file_offsets.resize(num_kept);
   }
 
-  closedir(dir);
-}
+  if (!options.perform_search) {
+    print_files(directory, worker_index);
+    file_offsets.clear();
+  }
 
-bool directory_search::try_dequeue_and_process_path(
-    moodycamel::ConsumerToken &ctok, hs_scratch_t *local_scratch, char *buffer,
-    std::string &lines) {
-  constexpr std::size_t BULK_DEQUEUE_SIZE = 32;
-  std::string entries[BULK_DEQUEUE_SIZE];
-  auto count = queue.try_dequeue_bulk(ctok, entries, BULK_DEQUEUE_SIZE);
-  if (count > 0) {
-    for (std::size_t j = 0; j < count; ++j) {
-      process_file(std::move(entries[j]), local_scratch, buffer, lines);
-    }
-    num_files_dequeued += count;
-    return true;
+  // One allocation for all the files in this directory
+  directory->files =
+      make_file_block(directory, names, file_offsets, state.file_nodes);
+  directory->num_pending =
+      subdirectory_offsets.size() + file_offsets.size() + 1;
+
+  // Keep the fd open for the entries if the budget allows,
+  // otherwise they are opened by full path
+  if (directory->fd != -1 && directory->num_pending > 1 &&
+      num_retained_fds > max_retained_fds) {
+    close(directory->fd);
+    directory->fd = -1;
+    num_retained_fds -= 1;
   }
 
-  return false;
+  for (const auto &offset : subdirectory_offsets) {
+    // Enqueue subdirectory for processing
+    auto subdirectory = state.arena.make_directory(directory, &names[offset]);
+    subdirectory->ignore = directory->ignore;
+    subdirectory->io_class = directory->io_class;
+    enqueue_directory(subdirectory);
+  }
+
+  if (options.read_order == file_read_order::traversal && !state.batch) {
+    for (const auto &file : state.file_nodes) {
+      enqueue_file(file);
+    }
+  } else if (options.read_order == file_read_order::traversal) {
+    const auto &files = state.file_nodes;
+    for (std::size_t i = 0; i < files.size(); i += FILES_PER_TASK) {
+      enqueue_files(std::vector<file_node *>(
+          files.begin() + i,
+          files.begin() + std::min(i + FILES_PER_TASK, files.size())));
+    }
+  } else if (!state.file_nodes.empty()) {
+    enqueue_ordered_files(directory, worker_index);
+  }
+
+  release_directory(directory);
+  finish_directory_visit();
 }
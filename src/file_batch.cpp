@@ -0,0 +1,94 @@
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <hypergrep/file_batch.hpp>
+#include <hypergrep/is_binary.hpp>
+#include <unistd.h>
+
+file_batch::file_batch(bool drop_cache, resource_governor *governor,
+                       io_concurrency *device_limits)
+    : buffer(std::make_unique<char[]>(FILE_BATCH_SIZE)),
+      drop_cache(drop_cache), governor(governor),
+      device_limits(device_limits) {}
+
+bool file_batch::read_file(int fd, const void *file,
+                           const struct stat &file_stat) {
+  const std::size_t size = file_stat.st_size;
+  if (size == 0 || size > TINY_FILE_SIZE || !has_room(size)) {
+    return false;
+  }
+
+  char *data = buffer.get() + used;
+  std::size_t bytes_read{0};
+  {
+    const auto slot =
+        device_limits ? device_limits->acquire(
+                            device_limits->classify(fd, file_stat.st_dev))
+                      : io_concurrency::slot{};
+    while (bytes_read < size) {
+      auto ret = pread(fd, data + bytes_read, size - bytes_read, bytes_read);
+      if (ret == -1 && errno == EINTR) {
+        continue;
+      }
+      if (ret <= 0) {
+        return false;
+      }
+      bytes_read += ret;
+    }
+  }
+  if (drop_cache) {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  }
+  if (governor) {
+    governor->pace(size);
+  }
+
+  if (starts_with_magic_bytes(data, size) || has_null_bytes(data, size)) {
+    return true;
+  }
+
+  data[size] = '\n';
+  files.push_back({file, file_stat, used, false});
+  used += size + 1;
+  return true;
+}
+
+int file_batch::on_batch_match(unsigned int, unsigned long long,
+                               unsigned long long to, unsigned int,
+                               void *ctx) {
+  auto batch = static_cast<file_batch *>(ctx);
+  auto &files = batch->files;
+
+  // The file that holds the last byte of the match
+  const std::size_t last = to > 0 ? to - 1 : 0;
+  auto it = std::upper_bound(
+      files.begin(), files.end(), last,
+      [](std::size_t offset, const batched_file &f) { return offset < f.offset; });
+  std::prev(it)->matched = true;
+  return 0;
+}
+
+void file_batch::scan(hs_database_t *database, hs_scratch_t *scratch,
+                      const on_match_fn &on_match) {
+  if (files.empty()) {
+    return;
+  }
+
+  // If the scan fails, each file is searched on its own
+  if (hs_scan(database, buffer.get(), used, 0, scratch, on_batch_match,
+              this) != HS_SUCCESS) {
+    for (auto &f : files) {
+      f.matched = true;
+    }
+  }
+
+  for (const auto &f : files) {
+    if (f.matched) {
+      on_match(f.file, f.file_stat,
+               std::string_view(buffer.get() + f.offset, f.file_stat.st_size));
+    }
+  }
+
+  files.clear();
+  used = 0;
+}
@@ -0,0 +1,31 @@
+#include <fcntl.h>
+#include <hypergrep/file_extent.hpp>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+bool first_physical_offset(int dirfd, const char *name,
+                           std::uint64_t &offset) {
+  int fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+  if (fd == -1) {
+    return false;
+  }
+
+  // Room for exactly one extent
+  alignas(struct fiemap) char
+      buffer[sizeof(struct fiemap) + sizeof(struct fiemap_extent)] = {};
+  auto map = reinterpret_cast<struct fiemap *>(buffer);
+  map->fm_start = 0;
+  map->fm_length = FIEMAP_MAX_OFFSET;
+  map->fm_extent_count = 1;
+
+  const bool result =
+      ioctl(fd, FS_IOC_FIEMAP, map) == 0 && map->fm_mapped_extents > 0;
+  close(fd);
+
+  if (result) {
+    offset = map->fm_extents[0].fe_physical;
+  }
+  return result;
+}
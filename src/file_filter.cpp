@@ -1,4 +1,7 @@
 #include <hypergrep/file_filter.hpp>
+#include <hypergrep/glob.hpp>
+#include <hypergrep/search_options.hpp>
+#include <stdexcept>
 
 bool construct_file_filtering_hs_database(hs_database **file_filter_database,
                                           hs_scratch **file_filter_scratch,
@@ -37,7 +40,8 @@ int on_file_filter_match(unsigned int, unsigned long long, unsigned long long,
   return HS_SUCCESS;
 }
 
-bool filter_file(const char *path, hs_database *file_filter_database,
+bool filter_file(const char *path, std::size_t length,
+                 hs_database *file_filter_database,
                  hs_scratch *local_file_filter_scratch,
                  const bool &negate_filter) {
 
@@ -48,7 +52,7 @@ bool filter_file(const char *path, hs_database *file_filter_database,
   bool result{false};
 
   filter_context ctx{false};
-  if (hs_scan(file_filter_database, path, strlen(path), 0,
+  if (hs_scan(file_filter_database, path, length, 0,
               local_file_filter_scratch, on_file_filter_match,
               (void *)(&ctx)) != HS_SUCCESS) {
     result = true;
@@ -61,4 +65,138 @@ bool filter_file(const char *path, hs_database *file_filter_database,
   }
 
   return result;
-}
\ No newline at end of file
+}
+
+bool construct_directory_filtering_hs_database(
+    hs_database **directory_filter_database,
+    hs_scratch **directory_filter_scratch, const search_options &options) {
+
+  const auto &patterns = options.exclude_directory_patterns;
+
+  std::vector<const char *> patterns_c;
+  std::vector<unsigned int> flags;
+  patterns_c.reserve(patterns.size());
+  flags.reserve(patterns.size());
+  for (const auto &pattern : patterns) {
+    patterns_c.push_back(pattern.c_str());
+    // Any match excludes the directory
+    flags.push_back(HS_FLAG_UTF8 | HS_FLAG_SINGLEMATCH);
+  }
+
+  hs_compile_error_t *compile_error = NULL;
+  auto error_code = hs_compile_multi(
+      patterns_c.data(), flags.data(), NULL, patterns.size(), HS_MODE_BLOCK,
+      NULL, directory_filter_database, &compile_error);
+  if (error_code != HS_SUCCESS) {
+    fprintf(stderr, "Error compiling pattern: %s\n", compile_error->message);
+    hs_free_compile_error(compile_error);
+    return false;
+  }
+
+  auto database_error =
+      hs_alloc_scratch(*directory_filter_database, directory_filter_scratch);
+  if (database_error != HS_SUCCESS) {
+    fprintf(stderr, "Error allocating scratch space\n");
+    hs_free_database(*directory_filter_database);
+    return false;
+  }
+
+  return true;
+}
+
+bool exclude_directory(const char *path, std::size_t length,
+                       hs_database *directory_filter_database,
+                       hs_scratch *local_directory_filter_scratch) {
+  // The first match is enough, so stop the scan there
+  const auto on_match = [](unsigned int, unsigned long long,
+                           unsigned long long, unsigned int,
+                           void *) -> int { return 1; };
+
+  return hs_scan(directory_filter_database, path, length, 0,
+                 local_directory_filter_scratch, on_match,
+                 NULL) == HS_SCAN_TERMINATED;
+}
+
+glob_filter::glob_filter(
+    const std::vector<std::string> &globs,
+    const std::vector<std::string> &case_insensitive_globs) {
+  std::vector<std::string> patterns;
+  std::vector<unsigned int> flags;
+  const auto add_globs = [&](const std::vector<std::string> &globs,
+                             unsigned int extra_flags) {
+    for (std::string_view glob : globs) {
+      const bool is_negated = !glob.empty() && glob[0] == '!';
+      if (is_negated) {
+        glob.remove_prefix(1);
+      }
+
+      // A trailing '/' only matches directories, i.e., the files in them
+      const bool directory_only = !glob.empty() && glob.back() == '/';
+      if (directory_only) {
+        glob.remove_suffix(1);
+      }
+
+      auto regex = glob_to_regex(glob);
+      regex.pop_back();
+      regex += directory_only ? "/" : "(?:/|$)";
+
+      patterns.push_back(std::move(regex));
+      flags.push_back(HS_FLAG_DOTALL | HS_FLAG_ALLOWEMPTY |
+                      HS_FLAG_SINGLEMATCH | extra_flags);
+      negated.push_back(is_negated);
+      has_include_globs = has_include_globs || !is_negated;
+    }
+  };
+  add_globs(globs, 0);
+  add_globs(case_insensitive_globs, HS_FLAG_CASELESS);
+
+  std::vector<const char *> patterns_c;
+  std::vector<unsigned int> ids;
+  patterns_c.reserve(patterns.size());
+  ids.reserve(patterns.size());
+  for (std::size_t i = 0; i < patterns.size(); ++i) {
+    patterns_c.push_back(patterns[i].c_str());
+    ids.push_back(i);
+  }
+
+  hs_compile_error_t *compile_error = NULL;
+  auto error_code = hs_compile_multi(
+      patterns_c.data(), flags.data(), ids.data(), patterns.size(),
+      HS_MODE_BLOCK, NULL, &database, &compile_error);
+  if (error_code != HS_SUCCESS) {
+    fprintf(stderr, "Error compiling glob: %s\n", compile_error->message);
+    hs_free_compile_error(compile_error);
+    throw std::runtime_error("Error compiling --glob patterns");
+  }
+}
+
+glob_filter::~glob_filter() {
+  if (database) {
+    hs_free_database(database);
+  }
+}
+
+bool glob_filter::alloc_scratch(hs_scratch **scratch) const {
+  return hs_alloc_scratch(database, scratch) == HS_SUCCESS;
+}
+
+int glob_filter::on_match(unsigned int id, unsigned long long,
+                          unsigned long long, unsigned int, void *ctx) {
+  auto last_match = static_cast<long long *>(ctx);
+  if (static_cast<long long>(id) > *last_match) {
+    *last_match = id;
+  }
+  return HS_SUCCESS;
+}
+
+bool glob_filter::accept(const char *path, std::size_t length,
+                         hs_scratch *local_glob_scratch) const {
+  long long last_match{-1};
+  hs_scan(database, path, length, 0, local_glob_scratch, on_match,
+          &last_match);
+
+  if (last_match < 0) {
+    return !has_include_globs;
+  }
+  return !negated[last_match];
+}
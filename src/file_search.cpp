@@ -3,7 +3,8 @@
 file_search::file_search(std::string &pattern,
                          argparse::ArgumentParser &program) {
   initialize_search(pattern, program, options, &database, &scratch,
-                    &file_filter_database, &file_filter_scratch);
+                    &file_filter_database, &file_filter_scratch,
+                    &stream_database);
 
   if (!program.is_used("-j")) {
     options.num_threads += 1;
@@ -11,8 +12,10 @@ file_search::file_search(std::string &pattern,
 }
 
 file_search::file_search(hs_database_t *database, hs_scratch_t *scratch,
-                         const search_options &options)
-    : database(database), scratch(scratch), options(options) {
+                         const search_options &options,
+                         task_scheduler *scheduler, bool buffer_output)
+    : scheduler(scheduler), buffer_output(buffer_output || scheduler),
+      database(database), scratch(scratch), options(options) {
   non_owning_database = true;
 }
 
@@ -24,17 +27,57 @@ file_search::~file_search() {
     if (database) {
       hs_free_database(database);
     }
+    delete stream_database;
   }
 
   for (const auto &s : thread_local_scratch) {
     hs_free_scratch(s);
   }
+
+  // Stop the workers before freeing their scratch
+  own_workers.reset();
+  for (const auto &s : worker_scratch) {
+    if (s) {
+      hs_free_scratch(s);
+    }
+  }
+}
+
+bool file_search::prepare_workers() {
+  std::call_once(workers_prepared, [this]() {
+    if (!scheduler) {
+      auto num_workers = options.num_threads;
+      if (num_workers > 1) {
+        num_workers -= 1;
+      }
+      own_workers = std::make_unique<task_scheduler>(num_workers);
+    }
+    const auto num_workers =
+        (scheduler ? scheduler : own_workers.get())->num_workers();
+
+    worker_scratch.resize(num_workers, nullptr);
+    for (auto &s : worker_scratch) {
+      if (hs_clone_scratch(scratch, &s) != HS_SUCCESS) {
+        return;
+      }
+    }
+    workers_ready = true;
+  });
+  return workers_ready;
 }
 
 void file_search::run(std::filesystem::path path,
-                      std::optional<std::size_t> maybe_file_size) {
+                      std::optional<std::size_t> maybe_file_size,
+                      std::string shard_path, int fd) {
+
+  if (shard_path.empty()) {
+    shard_path = path.native();
+  }
 
   if (!options.perform_search) {
+    if (options.shard && !in_shard(*options.shard, shard_path)) {
+      return;
+    }
     if (options.is_stdout) {
       fmt::print(fg(fmt::color::steel_blue), "{}\n", path.c_str());
     } else {
@@ -46,16 +89,9 @@ void file_search::run(std::filesystem::path path,
   if (!database) {
     throw std::runtime_error("Database is NULL");
   }
-  // Set up the scratch space
-  hs_scratch_t *local_scratch = NULL;
-  hs_error_t database_error = hs_alloc_scratch(database, &local_scratch);
-  if (database_error != HS_SUCCESS) {
-    throw std::runtime_error("Error allocating scratch space");
-  }
-  thread_local_scratch.push_back(local_scratch);
 
   // Memory map and search file in chunks multithreaded
-  mmap_and_scan(std::move(path), maybe_file_size);
+  mmap_and_scan(std::move(path), maybe_file_size, shard_path, fd);
 }
 
 struct chunk_result {
@@ -63,34 +99,167 @@ struct chunk_result {
   char *end{nullptr};
   std::vector<std::pair<unsigned long long, unsigned long long>> matches{};
   std::size_t line_count{0};
+  // Charged to the memory budget until printed
+  std::size_t memory{0};
 };
 
+namespace {
+
+// A claim in a large file takes 1/CLAIMS_PER_THREAD of a thread's share of
+// the rest of the file, from one block up to MAX_LARGE_FILE_CLAIM_SIZE
+constexpr std::size_t CLAIMS_PER_THREAD = 2;
+
+// How long the printing sleeps at a time while the next result is searched
+constexpr std::chrono::milliseconds RESULT_WAIT{1};
+
+// [begin, end) of a file that holds data. The rest are holes, which read
+// as zeros and hold no newlines.
+struct data_region {
+  std::size_t begin{0};
+  std::size_t end{0};
+};
+
+// The data regions of a sparse file, found with SEEK_DATA and SEEK_HOLE
+// All of the file if the filesystem can't tell.
+std::vector<data_region> find_data_regions(int fd, std::size_t file_size) {
+  std::vector<data_region> regions{};
+  off_t offset{0};
+  while (static_cast<std::size_t>(offset) < file_size) {
+    const off_t data = lseek(fd, offset, SEEK_DATA);
+    if (data == -1) {
+      // ENXIO: the rest is a hole
+      if (errno == ENXIO) {
+        break;
+      }
+      return {{0, file_size}};
+    }
+    off_t hole = lseek(fd, data, SEEK_HOLE);
+    if (hole == -1) {
+      hole = file_size;
+    }
+    if (static_cast<std::size_t>(data) >= file_size) {
+      break;
+    }
+    regions.push_back({static_cast<std::size_t>(data),
+                       std::min(static_cast<std::size_t>(hole), file_size)});
+    offset = hole;
+  }
+  return regions;
+}
+
+// The parts of [from, to) in a data region
+template <typename Fn>
+void for_each_data_range(const std::vector<data_region> &regions,
+                         std::size_t from, std::size_t to, Fn &&fn) {
+  auto it = std::partition_point(
+      regions.begin(), regions.end(),
+      [from](const data_region &r) { return r.end <= from; });
+  for (; it != regions.end() && it->begin < to; ++it) {
+    fn(std::max(it->begin, from), std::min(it->end, to));
+  }
+}
+
+std::size_t count_newlines(const char *buffer,
+                           const std::vector<data_region> &regions,
+                           std::size_t from, std::size_t to) {
+  std::size_t count{0};
+  for_each_data_range(
+      regions, from, to, [&count, buffer](std::size_t begin, std::size_t end) {
+        count += std::count(buffer + begin, buffer + end, '\n');
+      });
+  return count;
+}
+
+// Offset of the last newline in [from, to), if any
+std::optional<std::size_t>
+find_last_newline(const char *buffer, const std::vector<data_region> &regions,
+                  std::size_t from, std::size_t to) {
+  auto it = std::partition_point(
+      regions.begin(), regions.end(),
+      [to](const data_region &r) { return r.begin < to; });
+  while (it != regions.begin()) {
+    --it;
+    if (it->end <= from) {
+      break;
+    }
+    const std::size_t begin = std::max(it->begin, from);
+    const std::size_t end = std::min(it->end, to);
+    auto newline = static_cast<const char *>(
+        memrchr(buffer + begin, '\n', end - begin));
+    if (newline) {
+      return newline - buffer;
+    }
+  }
+  return {};
+}
+
+} // namespace
+
 bool file_search::mmap_and_scan(std::string &&filename,
-                                std::optional<std::size_t> maybe_file_size) {
-  int fd = open(filename.data(), O_RDONLY, 0);
+                                std::optional<std::size_t> maybe_file_size,
+                                std::string_view shard_path, int fd) {
+  const bool owns_fd = fd == -1;
+  if (owns_fd) {
+    fd = open(filename.data(), O_RDONLY, 0);
+  }
   if (fd == -1) {
     std::cerr << filename << ": " << std::strerror(errno) << " (os error " << errno << ")\n";
     return false;
   }
 
-  // Get the size of the file
+  // Get the size of the file, and the device it is on
+  struct stat sb{};
+  const bool stat_succeeded = fstat(fd, &sb) != -1;
   std::size_t file_size{0};
   if (maybe_file_size.has_value()) {
     file_size = maybe_file_size.value();
   } else {
-    struct stat sb;
-    if (fstat(fd, &sb) == -1) {
+    if (!stat_succeeded) {
+      if (owns_fd) {
+        close(fd);
+      }
       return false;
     }
     file_size = sb.st_size;
   }
+  const auto io_class = stat_succeeded && options.device_limits
+                            ? options.device_limits->classify(fd, sb.st_dev)
+                            : device_class::local;
 
   // Memory map the file
   char *buffer = (char *)mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
   if (buffer == MAP_FAILED) {
+    if (owns_fd) {
+      close(fd);
+    }
     return false;
   }
 
+  // Only the data regions of a sparse file are read. A chunk in a hole is
+  // empty, and a chunk across one is scanned around it.
+  const auto regions = find_data_regions(fd, file_size);
+
+  // Only a window of a file larger than LARGE_FILE_WINDOW_SIZE is kept
+  // resident: the search doesn't run further ahead of the printing than
+  // that, the pages behind the printing are dropped from the mapping, and
+  // the kernel is told to read ahead. With -l nothing is printed, and the
+  // search stops at the first match anyway.
+  static const std::size_t page_size = sysconf(_SC_PAGESIZE);
+  const bool windowed =
+      file_size > LARGE_FILE_WINDOW_SIZE && !options.print_only_filenames;
+  // Reads ahead would get around --io-limit
+  const bool read_ahead = !options.governor;
+  if (windowed) {
+    madvise(buffer, file_size, MADV_SEQUENTIAL);
+  } else if (read_ahead) {
+    madvise(buffer, file_size, MADV_WILLNEED);
+  }
+#ifdef MADV_HUGEPAGE
+  // Only taken up with read-only THP for files in the kernel, harmless
+  // otherwise
+  madvise(buffer, file_size, MADV_HUGEPAGE);
+#endif
+
   const auto process_fn =
       (options.is_stdout || options.print_only_matching_parts ||
        options.show_column_numbers || options.show_byte_offset)
@@ -107,142 +276,372 @@ bool file_search::mmap_and_scan(std::string &&filename,
                        // that hs_scan can handle
 
   // Algorithm:
-  // Spawn N-1 threads (N = max hardware concurrency)
-  // Each thread will be given: buffer, file_size, offset
-  // Each thread will search from the bytes {buffer + offset, buffer + offset +
-  // search_size} Each thread will print its results
-
-  auto max_concurrency = options.num_threads;
-  if (max_concurrency > 1) {
-    max_concurrency -= 1;
+  // Run one searching task per worker (N-1 workers, N = max hardware
+  // concurrency, unless there is a scheduler already)
+  // Each task claims the next chunk of the file from a shared cursor,
+  // searches it and puts its results in a reorder buffer, numbered in the
+  // order the chunks were claimed. This thread takes the results back in
+  // that order and prints them.
+
+  // On a scheduler, this worker helps run the tasks while it waits
+  if (!prepare_workers()) {
+    fprintf(stderr, "Error allocating scratch space\n");
+    munmap(buffer, file_size);
+    if (owns_fd) {
+      close(fd);
+    }
+    return false;
   }
+  task_scheduler *const workers = scheduler ? scheduler : own_workers.get();
+  const std::size_t max_concurrency = workers->num_workers();
 
-  // Each thread will enqueue its results into its queue
-  moodycamel::ConcurrentQueue<chunk_result> *output_queues =
-      new moodycamel::ConcurrentQueue<chunk_result>[max_concurrency];
-
-  std::vector<std::thread> threads(max_concurrency);
-  thread_local_scratch.reserve(max_concurrency);
+  reorder_buffer<chunk_result> results(max_concurrency);
 
-  std::atomic<std::size_t> num_threads_finished{0};
-  std::atomic<std::size_t> num_results_enqueued{0}, num_results_dequeued{0};
   std::atomic<std::size_t> num_matches{0};
   std::atomic<bool> single_match_found{false};
-
-  for (std::size_t i = 0; i < max_concurrency; ++i) {
-
-    // Set up the scratch space
-    hs_scratch_t *local_scratch = NULL;
-    hs_error_t database_error = hs_alloc_scratch(database, &local_scratch);
-    if (database_error != HS_SUCCESS) {
-      fprintf(stderr, "Error allocating scratch space\n");
-      hs_free_database(database);
-      return false;
+  // Set when a scan fails. The chunk it claimed is never printed, nor is
+  // anything after it, so every thread stops claiming.
+  std::atomic<bool> scan_aborted{false};
+
+  // With --max-memory, a result is charged to the budget until it is
+  // printed. Nothing is printed with -l, so nothing is charged.
+  const bool charge_results = options.memory && !options.print_only_filenames;
+  const auto charge = [this, charge_results](chunk_result &result) {
+    if (charge_results) {
+      result.memory = sizeof(chunk_result) + (result.end - result.start) +
+                      result.matches.capacity() * sizeof(result.matches[0]);
+      options.memory->acquire(result.memory);
     }
-    thread_local_scratch.push_back(local_scratch);
-
-    // Spawn a reader thread
-    threads[i] = std::thread(
-        [this, i = i, max_concurrency = max_concurrency, buffer = buffer,
-         file_size = file_size, max_searchable_size = max_searchable_size,
-         &output_queues, &num_results_enqueued, &num_threads_finished,
-         &single_match_found, &num_matches]() {
-          // Set up the scratch space
-          hs_scratch_t *local_scratch = thread_local_scratch[i];
+  };
+
+  // The file is claimed in blocks of `max_searchable_size`. The cursor
+  // holds the sequence number of the next claim in its upper half and the
+  // block the claim starts at in its lower half, so that both advance
+  // together. That is enough for files up to 2^32 blocks (256 TiB).
+  const std::size_t num_blocks =
+      (file_size + max_searchable_size - 1) / max_searchable_size;
+  std::atomic<std::uint64_t> cursor{0};
+
+  // End of the last chunk printed, and of the last read ahead advised
+  std::atomic<std::size_t> printed_offset{0};
+  std::atomic<std::size_t> advised_until{0};
+
+  // Tasks held back by the memory budget or the window are parked here,
+  // off the workers, until the printing moves on. `printing_progress`
+  // counts the results printed, so that a task that saw the printing
+  // before it moved on tries again rather than parking.
+  std::mutex parked_mutex;
+  std::atomic<std::size_t> printing_progress{0};
+  std::size_t num_parked{0};
+
+  // Claims are large at first and get smaller towards the end of the file,
+  // so that the threads run out of work together. With --shard, chunks
+  // are assigned to shards one block at a time, and so are the claims.
+  const std::size_t max_claim_blocks =
+      options.shard ? 1 : MAX_LARGE_FILE_CLAIM_SIZE / max_searchable_size;
+  const auto claim_size = [max_concurrency = max_concurrency, num_blocks,
+                           max_claim_blocks](std::size_t block) {
+    return std::clamp<std::size_t>(
+        (num_blocks - block) / (CLAIMS_PER_THREAD * max_concurrency), 1,
+        max_claim_blocks);
+  };
+
+  // Searches chunks until none are left. If it is held back by the memory
+  // budget or the window instead, returns the printing progress it saw.
+  const auto scan_chunks =
+      [this, max_concurrency = max_concurrency, buffer = buffer,
+       file_size = file_size, max_searchable_size = max_searchable_size,
+       num_blocks, shard_path, io_class, charge_results, windowed,
+       read_ahead, &charge, &claim_size, &regions, &cursor, &results,
+       &printed_offset, &advised_until, &printing_progress, &single_match_found,
+       &scan_aborted, &num_matches](std::size_t worker_index) -> std::optional<std::size_t> {
+        hs_scratch_t *local_scratch = worker_scratch[worker_index];
+
+        while (true) {
+
+          if (scan_aborted ||
+              (options.print_only_filenames && single_match_found)) {
+            break;
+          }
 
-          std::size_t offset{i * max_searchable_size};
-          char *eof = buffer + file_size;
+          auto claim = cursor.load();
+          const std::size_t sequence = claim >> 32;
+          const std::size_t first_block = claim & 0xFFFFFFFF;
+          if (first_block >= num_blocks) {
+            // stop here
+            break;
+          }
 
-          while (true) {
+          // While the memory budget is exhausted, the threads don't run
+          // ahead of the printing. The next chunks to print (one per
+          // thread) are always claimed, so the printing never waits on a
+          // thread that waits on it.
+          const std::size_t progress = printing_progress;
+          if (charge_results && options.memory->exhausted() &&
+              sequence >= results.next_sequence() + max_concurrency) {
+            return progress;
+          }
 
-            if (options.print_only_filenames && single_match_found) {
-              break;
-            }
+          // Nor beyond the window. The next chunk to print is less than a
+          // claim past the printing, well within it.
+          const std::size_t offset = first_block * max_searchable_size;
+          if (windowed && offset >= printed_offset + LARGE_FILE_WINDOW_SIZE) {
+            return progress;
+          }
 
-            char *start = buffer + offset;
-            if (start >= buffer + file_size) {
-              // stop here
-              num_threads_finished += 1;
-              break;
-            }
+          const std::size_t last_block = first_block + claim_size(first_block);
+          if (!cursor.compare_exchange_weak(
+                  claim, (std::uint64_t{sequence + 1} << 32) | last_block)) {
+            continue;
+          }
 
-            if (offset > 0) {
-              // Adjust start to go back to a newline boundary
-              // Adjust end as well to go back to a newline boundary
-              std::string_view chunk(buffer, start - buffer);
-
-              auto last_newline = chunk.find_last_of('\n', start - buffer);
-              if (last_newline == std::string_view::npos) {
-                // No newline found, do nothing?
-                // TODO: This could be an error scenario, check
-              } else {
-                start = buffer + last_newline;
+          // Keep the kernel reading LARGE_FILE_READ_AHEAD_SIZE past the
+          // claims, a step at a time
+          if (windowed && read_ahead) {
+            const std::size_t wanted =
+                std::min(last_block * max_searchable_size +
+                             LARGE_FILE_READ_AHEAD_SIZE,
+                         file_size);
+            auto advised = advised_until.load();
+            while (advised < wanted) {
+              const std::size_t next =
+                  std::min(advised + LARGE_FILE_READ_AHEAD_SIZE, file_size);
+              if (advised_until.compare_exchange_weak(advised, next)) {
+                madvise(buffer + advised, next - advised, MADV_WILLNEED);
+                advised = next;
               }
             }
+          }
 
-            char *end = buffer + offset + max_searchable_size;
-            if (end > eof) {
-              end = eof;
-            }
+          // Go back to a newline boundary at both ends, the end of one
+          // chunk is the start of the next
+          std::size_t start_offset{offset};
+          if (offset > 0) {
+            start_offset = find_last_newline(buffer, regions, 0, offset)
+                               .value_or(offset);
+          }
+          std::size_t end_offset =
+              std::min(last_block * max_searchable_size, file_size);
+          if (end_offset != file_size) {
+            end_offset =
+                find_last_newline(buffer, regions, start_offset, end_offset)
+                    .value_or(end_offset);
+          }
+          char *start = buffer + start_offset;
+          char *end = buffer + end_offset;
 
-            // Update end to stop at a newline boundary
-            std::string_view chunk(start, end - start);
-            if (end != eof) {
-              auto last_newline = chunk.find_last_of('\n', end - start);
-              if (last_newline == std::string_view::npos) {
-                // No newline found, do nothing?
-                // TODO: This could be an error scenario, check
-              } else {
-                end = start + last_newline;
-              }
-            }
+          // A chunk of another shard is skipped, but its lines
+          // still count towards the line numbers
+          if (options.shard &&
+              !in_shard(*options.shard, shard_path, first_block)) {
+            std::size_t line_count_at_end_of_chunk =
+                options.show_line_numbers
+                    ? count_newlines(buffer, regions, start_offset, end_offset)
+                    : 0;
+            chunk_result skipped_chunk_result{start, end, {},
+                                              line_count_at_end_of_chunk};
+            charge(skipped_chunk_result);
+            results.put(sequence, std::move(skipped_chunk_result));
+            continue;
+          }
 
-            // Perform the search
-            std::vector<std::pair<unsigned long long, unsigned long long>>
-                matches{};
-            std::atomic<size_t> number_of_matches = 0;
-            file_context ctx{number_of_matches, matches,
-                             options.print_only_filenames};
-
-            if (hs_scan(database, start, end - start, 0, local_scratch,
-                        on_match, (void *)(&ctx)) != HS_SUCCESS) {
-              if (options.print_only_filenames && ctx.number_of_matches > 0) {
-                single_match_found = true;
-              }
-              num_threads_finished += 1;
-              break;
+          // Perform the search
+          std::vector<std::pair<unsigned long long, unsigned long long>>
+              matches{};
+          std::atomic<size_t> number_of_matches = 0;
+          file_context ctx{number_of_matches, matches,
+                           options.print_only_filenames};
+
+          // Each data range of the chunk is scanned on its own, with a byte
+          // of the adjacent hole, if any, so that a pattern anchored to the
+          // start or end of the data doesn't match next to a hole. Match
+          // offsets are made relative to the chunk.
+          bool scan_failed{false};
+          for_each_data_range(
+              regions, start_offset, end_offset,
+              [&](std::size_t range_begin, std::size_t range_end) {
+                if (scan_failed) {
+                  return;
+                }
+                if (range_begin > start_offset) {
+                  range_begin -= 1;
+                }
+                if (range_end < end_offset) {
+                  range_end += 1;
+                }
+
+                // The range is read (faulted in) as it is scanned
+                if (options.governor) {
+                  options.governor->pace(range_end - range_begin);
+                }
+
+                // The pages are read in by MADV_POPULATE_READ, under a read
+                // slot, and scanned from memory without one. Kernels before
+                // 5.14 refuse it, and then the scan itself faults the pages
+                // in, so it keeps the slot.
+                std::optional<io_concurrency::slot> slot{};
+                if (options.device_limits) {
+                  slot.emplace(options.device_limits->acquire(io_class));
+                }
+#ifdef MADV_POPULATE_READ
+                const std::size_t populate_begin =
+                    range_begin / page_size * page_size;
+                if (madvise(buffer + populate_begin,
+                            range_end - populate_begin,
+                            MADV_POPULATE_READ) == 0) {
+                  slot.reset();
+                }
+#endif
+                const auto first_match = matches.size();
+                if (hs_scan(database, buffer + range_begin,
+                            range_end - range_begin, 0, local_scratch,
+                            on_match, (void *)(&ctx)) != HS_SUCCESS) {
+                  scan_failed = true;
+                }
+                for (auto m = first_match; m < matches.size(); ++m) {
+                  matches[m].first += range_begin - start_offset;
+                  matches[m].second += range_begin - start_offset;
+                }
+              });
+          if (scan_failed) {
+            if (options.print_only_filenames && ctx.number_of_matches > 0) {
+              single_match_found = true;
+            } else {
+              scan_aborted = true;
             }
+            break;
+          }
 
-            num_matches += ctx.number_of_matches;
+          num_matches += ctx.number_of_matches;
 
-            // Save result
-            std::size_t line_count_at_end_of_chunk =
-                std::count(start, end, '\n');
-            chunk_result local_chunk_result{start, end, std::move(matches),
-                                            line_count_at_end_of_chunk};
-            output_queues[i].enqueue(std::move(local_chunk_result));
-            num_results_enqueued += 1;
+          // Save result
+          std::size_t line_count_at_end_of_chunk =
+              count_newlines(buffer, regions, start_offset, end_offset);
+          chunk_result local_chunk_result{start, end, std::move(matches),
+                                          line_count_at_end_of_chunk};
+          charge(local_chunk_result);
+          results.put(sequence, std::move(local_chunk_result));
+        }
 
-            offset += max_concurrency * max_searchable_size;
-          }
-        });
+        results.producer_done();
+        return {};
+      };
+
+  // A task held back by the memory budget or the window parks and returns,
+  // rather than waiting on its worker, where it could sit on top of the
+  // task that prints its results
+  const auto submit_scan = [workers, &scan_chunks, &parked_mutex,
+                            &printing_progress, &num_parked]() {
+    workers->submit_leaf([&scan_chunks, &parked_mutex, &printing_progress,
+                          &num_parked](std::size_t worker_index) {
+      while (const auto progress = scan_chunks(worker_index)) {
+        std::lock_guard<std::mutex> lock(parked_mutex);
+        if (printing_progress == *progress) {
+          num_parked += 1;
+          return;
+        }
+      }
+    });
+  };
+  for (std::size_t i = 0; i < max_concurrency; ++i) {
+    submit_scan();
   }
 
+  // Called once a result is printed, to submit the parked tasks again
+  const auto resume_parked = [&parked_mutex, &printing_progress, &num_parked,
+                              &submit_scan]() {
+    std::size_t num_resumed{0};
+    {
+      std::lock_guard<std::mutex> lock(parked_mutex);
+      printing_progress += 1;
+      num_resumed = std::exchange(num_parked, 0);
+    }
+    for (; num_resumed > 0; --num_resumed) {
+      submit_scan();
+    }
+  };
+
+  // Other files are printed concurrently when running on a scheduler
+  // so buffer this file's output and print it in one go at the end
+  std::string output{};
+  const auto print_output = [this, &output](std::string_view str) {
+    if (buffer_output) {
+      output += str;
+    } else {
+      fmt::print("{}", str);
+    }
+  };
+
+  // Outside the window, and with --no-cache, pages are dropped once their
+  // lines are printed (from the page cache too, with --no-cache). The
+  // chunks being scanned only fault back in what they still need.
+  std::size_t dropped{0};
+  const auto drop_behind = [this, buffer = buffer, fd, &dropped](char *end) {
+    const std::size_t upto = (end - buffer) / page_size * page_size;
+    if (upto > dropped) {
+      madvise(buffer + dropped, upto - dropped, MADV_DONTNEED);
+      if (options.no_cache) {
+        posix_fadvise(fd, dropped, upto - dropped, POSIX_FADV_DONTNEED);
+      }
+      dropped = upto;
+    }
+  };
+
   std::size_t num_matching_lines{0};
   bool filename_printed{false};
   std::size_t current_line_number = 1;
-  std::size_t i = 0;
+
+  // With --max-memory, the buffered output is charged to the budget, and
+  // printed early once the budget is exhausted. Another file's output may
+  // follow, so the rest of this file's starts over with its name.
+  std::size_t output_charged{0};
+  bool output_printed_early{false};
+  const auto print_output_if_over_budget = [&]() {
+    if (!options.memory || !buffer_output) {
+      return;
+    }
+    options.memory->acquire(output.size() - output_charged);
+    output_charged = output.size();
+    if (!options.memory->exhausted()) {
+      return;
+    }
+    if (options.is_stdout) {
+      output += "\n";
+    }
+    fmt::print("{}", output);
+    options.memory->release(output_charged);
+    output.clear();
+    output_charged = 0;
+    output_printed_early = true;
+    filename_printed = false;
+  };
 
   if (!options.print_only_filenames) {
     // In this main thread
-    // Dequeue from output_queues, process matches
+    // Take the results in order, process matches
     // and print output
-    while (!(num_threads_finished == max_concurrency &&
-             num_results_enqueued == num_results_dequeued)) {
+    using result_status = reorder_buffer<chunk_result>::status;
+    while (true) {
       chunk_result next_result{};
 
-      auto found = output_queues[i].try_dequeue(next_result);
-      if (found) {
+      // Until the next result is put, a worker of the scheduler helps with
+      // the pending tasks, and a thread sleeps
+      auto status = results.try_take(next_result);
+      if (status == result_status::pending) {
+        if (workers->try_run_pending_task()) {
+          continue;
+        }
+        // The printing won't move on past a failed scan, so the parked
+        // tasks are woken up to see that and stop
+        if (scan_aborted) {
+          resume_parked();
+        }
+        status = results.take(next_result, RESULT_WAIT);
+      }
+      if (status == result_status::done) {
+        break;
+      }
+      if (status == result_status::ready) {
 
         // Do something with result
         // Print it
@@ -265,28 +664,42 @@ bool file_search::mmap_and_scan(std::string &&filename,
 
             if (options.print_filenames && !filename_printed) {
               if (options.is_stdout) {
-                fmt::print(fg(fmt::color::steel_blue), "{}\n", filename);
+                print_output(fmt::format(fg(fmt::color::steel_blue), "{}\n",
+                                         filename));
               }
               filename_printed = true;
             }
 
-            fmt::print("{}", lines);
+            print_output(lines);
+            print_output_if_over_budget();
           }
         }
         current_line_number += next_result.line_count;
 
-        num_results_dequeued += 1;
+        // The next chunk starts where this one ends
+        printed_offset = next_result.end - buffer;
+        if (windowed || options.no_cache) {
+          drop_behind(next_result.end);
+        }
 
-        i += 1;
-        if (i == max_concurrency) {
-          i = 0;
+        if (charge_results) {
+          options.memory->release(next_result.memory);
         }
+        resume_parked();
       }
     }
   }
 
-  for (auto &t : threads) {
-    t.join();
+  // Until the last scan is done, a worker of the scheduler helps with the
+  // pending scans (of this or any other file), and a thread sleeps
+  while (!results.done()) {
+    if (!workers->try_run_pending_task()) {
+      results.wait_done(RESULT_WAIT);
+    }
+  }
+
+  if (scan_aborted) {
+    fprintf(stderr, "%s: Error searching file\n", filename.c_str());
   }
 
   if ((num_matching_lines > 0 || options.count_include_zeros) &&
@@ -327,41 +740,43 @@ bool file_search::mmap_and_scan(std::string &&filename,
   if (munmap(buffer, file_size) == -1) {
     return false;
   }
+  if (options.no_cache) {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  }
 
   // Close the file
-  if (close(fd) == -1) {
+  if (owns_fd && close(fd) == -1) {
     return false;
   }
 
-  delete[] output_queues;
+  if (options.is_stdout && num_matching_lines > 0 &&
+      !(output_printed_early && output.empty())) {
+    print_output("\n");
+  }
 
-  if (options.is_stdout && num_matching_lines > 0) {
-    fmt::print("\n");
+  if (!output.empty()) {
+    fmt::print("{}", output);
+  }
+  if (options.memory) {
+    options.memory->release(output_charged);
   }
 
   return true;
 }
 
-bool file_search::scan_line(std::string &line, std::size_t &current_line_number,
-                            bool &break_loop) {
-  static hs_scratch_t *local_scratch = NULL;
-  static bool scratch_allocated = [this]() -> bool {
-    if (!database) {
-      throw std::runtime_error("Database is NULL");
-    }
-    // Set up the scratch space
-    hs_error_t database_error = hs_alloc_scratch(database, &local_scratch);
-    if (database_error != HS_SUCCESS) {
-      throw std::runtime_error("Error allocating scratch space");
-    }
-    thread_local_scratch.push_back(local_scratch);
-
-    return true;
-  }();
+void file_search::run_stdin() {
+  if (!database) {
+    throw std::runtime_error("Database is NULL");
+  }
 
-  if (!scratch_allocated) {
-    return false;
+  hs_scratch_t *local_scratch = NULL;
+  if (hs_alloc_scratch(database, &local_scratch) != HS_SUCCESS) {
+    throw std::runtime_error("Error allocating scratch space");
   }
+  thread_local_scratch.push_back(local_scratch);
+
+  chunk_stream stream{database, stream_database};
+  stream.reset();
 
   const auto process_fn =
       (options.is_stdout || options.print_only_matching_parts ||
@@ -369,48 +784,94 @@ bool file_search::scan_line(std::string &line, std::size_t &current_line_number,
           ? process_matches
           : process_matches_nocolor_nostdout;
 
-  // Perform the search
-  bool result{false};
-  std::vector<std::pair<unsigned long long, unsigned long long>> matches{};
-  std::atomic<size_t> number_of_matches = 0;
-  file_context ctx{number_of_matches, matches, options.print_only_filenames};
+  // Lines are printed chunk by chunk, as the input may never end
+  const bool print_lines = !options.count_matching_lines &&
+                           !options.count_matches &&
+                           !options.print_only_filenames;
 
-  if (hs_scan(database, line.data(), line.size(), 0, local_scratch, on_match,
-              (void *)(&ctx)) != HS_SUCCESS) {
-    if (options.print_only_filenames && ctx.number_of_matches > 0) {
-      break_loop = true;
+  bool result{false};
+  std::size_t current_line_number{1};
+  std::size_t num_matching_lines{0};
+  std::size_t num_matches{0};
+  std::string lines{};
+  const std::string filename{""};
+
+  chunk_reader reader{};
+  reader.reset(STDIN_FILENO);
+  std::string_view chunk{};
+  long_line_matches long_line{};
+  while (true) {
+    const auto status = reader.next(chunk);
+    if (status == chunk_reader::status::end_of_file) {
+      break;
     }
-    result = false;
-  } else {
+
+    std::vector<std::pair<unsigned long long, unsigned long long>> matches{};
+    std::atomic<size_t> number_of_matches = 0;
+    file_context ctx{number_of_matches, matches, options.print_only_filenames};
+
+    const auto scan_result =
+        stream.scan(local_scratch, chunk, reader.chunk_offset(),
+                    reader.done(), ctx);
     if (ctx.number_of_matches > 0) {
       result = true;
     }
-  }
+    if (scan_result != HS_SUCCESS) {
+      break;
+    }
 
-  // Process matches with this line number as the start line number
-  // (for this chunk)
-  if (ctx.number_of_matches > 0) {
-    std::string lines{};
-    const std::string filename{""};
-    process_fn(filename.data(), line.data(), line.size(), ctx.matches,
-               current_line_number, lines, false, options.is_stdout,
-               options.show_line_numbers, options.show_column_numbers,
-               options.show_byte_offset, options.print_only_matching_parts,
-               options.max_column_limit, 0, options.ltrim_each_output_line);
+    const std::size_t chunk_line_number = current_line_number;
+    if (status == chunk_reader::status::line_piece) {
+      long_line.add_piece(chunk, chunk_line_number, ctx.number_of_matches);
+      num_matches += ctx.number_of_matches;
+    } else if (long_line.in_line) {
+      num_matching_lines +=
+          long_line.finish(lines, filename.data(), false, options.is_stdout,
+                           options.show_line_numbers);
+    }
+
+    if (status == chunk_reader::status::chunk && ctx.number_of_matches > 0) {
+      num_matching_lines += process_fn(
+          filename.data(), chunk.data(), chunk.size(), ctx.matches,
+          current_line_number, lines, false, options.is_stdout,
+          options.show_line_numbers, options.show_column_numbers,
+          options.show_byte_offset, options.print_only_matching_parts,
+          options.max_column_limit, reader.chunk_offset(),
+          options.ltrim_each_output_line);
+      num_matches += ctx.number_of_matches;
+    }
 
-    if (!options.count_matching_lines && !options.print_only_filenames &&
-        result && !lines.empty()) {
+    if (options.show_line_numbers) {
+      current_line_number =
+          chunk_line_number + std::count(chunk.begin(), chunk.end(), '\n');
+    }
+
+    if (print_lines && !lines.empty()) {
       fmt::print("{}", lines);
-    } else if (options.print_only_filenames) {
-      if (options.is_stdout) {
-        fmt::print(fg(fmt::color::steel_blue), "<stdin>\n");
-      } else {
-        fmt::print("<stdin>\n");
-      }
+      std::fflush(stdout);
     }
+    lines.clear();
   }
 
-  current_line_number += 1;
+  // The input may end with a long line
+  num_matching_lines +=
+      long_line.finish(lines, filename.data(), false, options.is_stdout,
+                       options.show_line_numbers);
+  if (print_lines && !lines.empty()) {
+    fmt::print("{}", lines);
+  }
 
-  return result;
+  if ((result || options.count_include_zeros) &&
+      options.count_matching_lines && !options.print_only_filenames) {
+    fmt::print("{}\n", num_matching_lines);
+  } else if ((result || options.count_include_zeros) &&
+             options.count_matches && !options.print_only_filenames) {
+    fmt::print("{}\n", num_matches);
+  } else if (result && options.print_only_filenames) {
+    if (options.is_stdout) {
+      fmt::print(fg(fmt::color::steel_blue), "<stdin>\n");
+    } else {
+      fmt::print("<stdin>\n");
+    }
+  }
 }
@@ -0,0 +1,179 @@
+#include <fmt/format.h>
+#include <hypergrep/file_types.hpp>
+#include <hypergrep/glob.hpp>
+#include <map>
+#include <stdexcept>
+#include <string_view>
+
+namespace {
+
+struct builtin_file_type {
+  std::string_view name;
+  std::string_view globs;
+};
+
+constexpr builtin_file_type BUILTIN_FILE_TYPES[] = {
+    {"asm", "*.asm,*.s,*.S"},
+    {"c", "*.c,*.h"},
+    {"cmake", "*.cmake,CMakeLists.txt"},
+    {"cpp", "*.cpp,*.cc,*.cxx,*.c++,*.hpp,*.hh,*.hxx,*.h++,*.h,*.inl,*.ipp"},
+    {"cs", "*.cs"},
+    {"css", "*.css,*.scss,*.sass,*.less"},
+    {"go", "*.go"},
+    {"html", "*.html,*.htm"},
+    {"java", "*.java"},
+    {"js", "*.js,*.jsx,*.mjs,*.cjs"},
+    {"json", "*.json"},
+    {"kotlin", "*.kt,*.kts"},
+    {"log", "*.log"},
+    {"lua", "*.lua"},
+    {"make", "Makefile,makefile,GNUmakefile,*.mk,*.mak"},
+    {"markdown", "*.md,*.markdown"},
+    {"php", "*.php"},
+    {"py", "*.py,*.pyi"},
+    {"rb", "*.rb"},
+    {"rust", "*.rs"},
+    {"sh", "*.sh,*.bash,*.zsh"},
+    {"sql", "*.sql"},
+    {"swift", "*.swift"},
+    {"toml", "*.toml"},
+    {"ts", "*.ts,*.tsx"},
+    {"txt", "*.txt"},
+    {"xml", "*.xml"},
+    {"yaml", "*.yaml,*.yml"},
+};
+
+// Never searched unless selected with --type
+constexpr std::string_view SKIPPED_FILE_GLOBS =
+    "*.o,*.so,*.png,*.jpg,*.jpeg,*.mp3,*.mp4,*.gz,*.xz,*.zip";
+
+// Pattern IDs, one bit each in the match context
+enum : unsigned int { SELECTED = 0, NEGATED = 1, SKIPPED = 2 };
+
+void split_globs(std::string_view globs, std::vector<std::string> &out) {
+  while (!globs.empty()) {
+    const auto end = globs.find(',');
+    const auto glob = globs.substr(0, end);
+    if (!glob.empty()) {
+      out.emplace_back(glob);
+    }
+    globs.remove_prefix(end == std::string_view::npos ? globs.size()
+                                                      : end + 1);
+  }
+}
+
+std::map<std::string, std::vector<std::string>, std::less<>>
+make_registry(const std::vector<std::string> &definitions) {
+  std::map<std::string, std::vector<std::string>, std::less<>> registry;
+  for (const auto &type : BUILTIN_FILE_TYPES) {
+    split_globs(type.globs, registry[std::string(type.name)]);
+  }
+
+  // --type-add extends an existing type or defines a new one
+  for (const auto &definition : definitions) {
+    const auto colon = definition.find(':');
+    if (colon == std::string::npos || colon == 0 ||
+        colon + 1 == definition.size()) {
+      throw std::runtime_error("Invalid --type-add '" + definition +
+                               "', expected name:glob[,glob...]");
+    }
+    split_globs(std::string_view(definition).substr(colon + 1),
+                registry[definition.substr(0, colon)]);
+  }
+  return registry;
+}
+
+} // namespace
+
+file_type_filter::file_type_filter(
+    const std::vector<std::string> &selected_types,
+    const std::vector<std::string> &negated_types,
+    const std::vector<std::string> &definitions) {
+  const auto registry = make_registry(definitions);
+
+  std::vector<std::string> patterns;
+  std::vector<unsigned int> ids;
+  const auto add_types = [&](const std::vector<std::string> &types,
+                             unsigned int id) {
+    for (const auto &type : types) {
+      auto it = registry.find(type);
+      if (it == registry.end()) {
+        throw std::runtime_error("Unknown file type '" + type +
+                                 "', see --type-list");
+      }
+      for (const auto &glob : it->second) {
+        patterns.push_back(glob_to_regex(glob));
+        ids.push_back(id);
+      }
+    }
+  };
+  add_types(selected_types, SELECTED);
+  add_types(negated_types, NEGATED);
+  has_selected_types = !selected_types.empty();
+
+  std::vector<std::string> skipped;
+  split_globs(SKIPPED_FILE_GLOBS, skipped);
+  for (const auto &glob : skipped) {
+    patterns.push_back(glob_to_regex(glob));
+    ids.push_back(SKIPPED);
+  }
+
+  std::vector<const char *> patterns_c;
+  std::vector<unsigned int> flags;
+  patterns_c.reserve(patterns.size());
+  flags.reserve(patterns.size());
+  for (const auto &pattern : patterns) {
+    patterns_c.push_back(pattern.c_str());
+    flags.push_back(HS_FLAG_DOTALL | HS_FLAG_ALLOWEMPTY |
+                    HS_FLAG_SINGLEMATCH);
+  }
+
+  hs_compile_error_t *compile_error = NULL;
+  auto error_code = hs_compile_multi(
+      patterns_c.data(), flags.data(), ids.data(), patterns.size(),
+      HS_MODE_BLOCK, NULL, &database, &compile_error);
+  if (error_code != HS_SUCCESS) {
+    const std::string message =
+        std::string("Error compiling file types: ") + compile_error->message;
+    hs_free_compile_error(compile_error);
+    throw std::runtime_error(message);
+  }
+}
+
+file_type_filter::~file_type_filter() {
+  if (database) {
+    hs_free_database(database);
+  }
+}
+
+bool file_type_filter::alloc_scratch(hs_scratch_t **scratch) const {
+  return hs_alloc_scratch(database, scratch) == HS_SUCCESS;
+}
+
+int file_type_filter::on_match(unsigned int id, unsigned long long,
+                               unsigned long long, unsigned int, void *ctx) {
+  auto matched = static_cast<unsigned int *>(ctx);
+  *matched |= (1u << id);
+  // A negated type excludes the file no matter what else matches
+  return (id == NEGATED) ? 1 : 0;
+}
+
+bool file_type_filter::accept(const char *name, std::size_t length,
+                              hs_scratch_t *scratch) const {
+  unsigned int matched{0};
+  hs_scan(database, name, length, 0, scratch, on_match, &matched);
+
+  if (matched & (1u << NEGATED)) {
+    return false;
+  }
+  if (has_selected_types) {
+    return matched & (1u << SELECTED);
+  }
+  return !(matched & (1u << SKIPPED));
+}
+
+void print_file_types(const std::vector<std::string> &definitions) {
+  for (const auto &[name, globs] : make_registry(definitions)) {
+    fmt::print("{}: {}\n", name, fmt::join(globs, ", "));
+  }
+}
@@ -1,28 +1,74 @@
 #include <hypergrep/git_index_search.hpp>
 #include <hypergrep/is_binary.hpp>
+#include <algorithm>
 #include <unordered_set>
 
 git_index_search::git_index_search(std::string &pattern,
                                    const std::filesystem::path &path,
+                                   std::string_view search_path,
                                    argparse::ArgumentParser &program)
-    : basepath(std::filesystem::relative(path)) {
+    : basepath(std::filesystem::relative(path)),
+      directory_prefix(search_path) {
   initialize_search(pattern, program, options, &database, &scratch,
-                    &file_filter_database, &file_filter_scratch);
+                    &file_filter_database, &file_filter_scratch,
+                    &stream_database);
+  if (!directory_prefix.empty() && directory_prefix.back() != '/') {
+    directory_prefix += '/';
+  }
+
+  if (!options.exclude_directory_patterns.empty()) {
+    if (!construct_directory_filtering_hs_database(
+            &directory_filter_database, &directory_filter_scratch, options)) {
+      throw std::runtime_error("Error compiling --exclude-dir patterns");
+    }
+  }
+
+  // The search path is the current directory
+  struct stat sb;
+  if (options.one_file_system && stat(".", &sb) == 0) {
+    root_device = sb.st_dev;
+  }
+  if (options.deduplicate_inodes) {
+    visited_files = std::make_unique<inode_set>(options.report_aliases);
+  }
+  if (options.perform_search) {
+    large_file_searcher = std::make_unique<file_search>(
+        database, scratch, options, nullptr, true);
+  }
 }
 
 git_index_search::git_index_search(hs_database_t *database,
+                                   streaming_database *stream_database,
                                    hs_scratch_t *scratch,
                                    hs_database_t *file_filter_database,
                                    hs_scratch_t *file_filter_scratch,
                                    const search_options &options,
                                    const std::filesystem::path &path)
-    : basepath(path), database(database), scratch(scratch),
-      file_filter_database(file_filter_database),
-      file_filter_scratch(file_filter_scratch), options(options) {
+    : basepath(path), database(database), stream_database(stream_database),
+      scratch(scratch), file_filter_database(file_filter_database),
+      file_filter_scratch(file_filter_scratch), directory_prefix(path.string()),
+      options(options) {
   non_owning_database = true;
+  if (!directory_prefix.empty() && directory_prefix.back() != '/') {
+    directory_prefix += '/';
+  }
+  if (options.deduplicate_inodes) {
+    visited_files = std::make_unique<inode_set>(options.report_aliases);
+  }
+  if (options.perform_search) {
+    large_file_searcher = std::make_unique<file_search>(
+        database, scratch, options, nullptr, true);
+  }
 }
 
 git_index_search::~git_index_search() {
+  if (file_type_scratch) {
+    hs_free_scratch(file_type_scratch);
+  }
+  if (glob_scratch) {
+    hs_free_scratch(glob_scratch);
+  }
+
   if (!non_owning_database) {
     if (scratch) {
       hs_free_scratch(scratch);
@@ -30,12 +76,19 @@ git_index_search::~git_index_search() {
     if (database) {
       hs_free_database(database);
     }
+    delete stream_database;
     if (file_filter_scratch) {
       hs_free_scratch(file_filter_scratch);
     }
     if (file_filter_database) {
       hs_free_database(file_filter_database);
     }
+    if (directory_filter_scratch) {
+      hs_free_scratch(directory_filter_scratch);
+    }
+    if (directory_filter_database) {
+      hs_free_database(directory_filter_database);
+    }
   }
 
   for (auto &iter : garbage_collect_index_iterator) {
@@ -53,27 +106,211 @@ git_index_search::~git_index_search() {
 }
 
 void git_index_search::search_thread_function() {
-  char buffer[FILE_CHUNK_SIZE];
+  chunk_reader reader{options.no_cache, options.governor.get(),
+                      options.device_limits.get()};
   std::string lines{};
 
   hs_scratch_t *local_scratch = NULL;
-  hs_error_t database_error = hs_alloc_scratch(database, &local_scratch);
-  if (database_error != HS_SUCCESS) {
+  if (hs_alloc_scratch(database, &local_scratch) != HS_SUCCESS) {
     throw std::runtime_error("Error allocating scratch space\n");
   }
-
-  while (true) {
-    if (num_files_enqueued > 0) {
-      try_dequeue_and_process_path(local_scratch, buffer, lines);
+  chunk_stream stream{database, stream_database};
+
+  // Blocking reads, unless io_uring is requested and available
+  std::unique_ptr<io_ring> ring{};
+  if (options.io_depth > 0) {
+    ring = std::make_unique<io_ring>(2 * options.io_depth);
+    if (!ring->ok()) {
+      ring.reset();
     }
-    if (!running && num_files_dequeued == num_files_enqueued) {
-      break;
+  }
+
+  // Tiny files are scanned a dequeued bulk at a time
+  std::unique_ptr<file_batch> batch{};
+  if (options.batch_tiny_files) {
+    batch = std::make_unique<file_batch>(options.no_cache,
+                                         options.governor.get(),
+                                         options.device_limits.get());
+  }
+
+  // The read buffers of this thread, for as long as it runs
+  const std::size_t buffers_size =
+      CHUNK_READER_BUFFER_SIZE + (batch ? FILE_BATCH_SIZE : 0) +
+      (ring ? options.io_depth * FILE_CHUNK_SIZE : 0);
+  if (options.memory) {
+    options.memory->acquire(buffers_size);
+  }
+
+  // The ring hands whatever it can't finish over to blocking reads
+  if (!ring ||
+      !search_with_io_ring(*ring, local_scratch, stream, reader, lines)) {
+    while (true) {
+      if (num_files_enqueued > 0) {
+        try_dequeue_and_process_path(local_scratch, stream, reader, lines,
+                                     batch.get());
+      }
+      if (!running && num_files_dequeued == num_files_enqueued) {
+        break;
+      }
+      if (options.governor) {
+        options.governor->throttle_cpu();
+      }
     }
   }
 
+  if (options.memory) {
+    options.memory->release(buffers_size);
+  }
   hs_free_scratch(local_scratch);
 }
 
+bool git_index_search::search_with_io_ring(io_ring &ring,
+                                           hs_scratch_t *local_scratch,
+                                           chunk_stream &stream,
+                                           chunk_reader &reader,
+                                           std::string &lines) {
+  // Each file in flight holds a slot, first while it is opened, then
+  // while its first chunk is read. The request is in the low bits of the
+  // user data, the slot (or for a close, the fd) in the rest. Closes don't
+  // need a slot.
+  enum : std::uint64_t { OPEN = 0, READ = 1, CLOSE = 2, REQUEST_BITS = 2 };
+  struct slot {
+    const char *filename{nullptr};
+    int fd{-1};
+    std::unique_ptr<char[]> buffer{};
+  };
+
+  const std::size_t depth = options.io_depth;
+  std::vector<slot> slots(depth);
+  std::vector<std::size_t> free_slots(depth);
+  std::iota(free_slots.rbegin(), free_slots.rend(), 0);
+  for (auto &s : slots) {
+    s.buffer = std::make_unique<char[]>(FILE_CHUNK_SIZE);
+  }
+  std::size_t num_requests_in_flight{0};
+
+  // Once the ring fails, it is only used to wait for what was submitted
+  bool ring_failed{false};
+
+  // Finish what a request would have started with blocking calls, when
+  // the ring can't take it
+  auto finish_blocking = [&](std::uint64_t user_data) {
+    const auto request = user_data & ((1 << REQUEST_BITS) - 1);
+    const auto index = user_data >> REQUEST_BITS;
+    if (request == CLOSE) {
+      ::close(static_cast<int>(index));
+      return;
+    }
+    auto &s = slots[index];
+    if (request == OPEN) {
+      process_file(s.filename, local_scratch, stream, reader, lines, nullptr);
+    } else {
+      search_file(s.fd, s.filename, {}, local_scratch, stream, reader, lines,
+                  nullptr);
+      ::close(s.fd);
+    }
+    free_slots.push_back(index);
+  };
+
+  while (true) {
+    // Open as many files as there are free slots
+    if (!ring_failed && !free_slots.empty() && num_files_enqueued > 0) {
+      constexpr std::size_t BULK_DEQUEUE_SIZE = 32;
+      const char *entries[BULK_DEQUEUE_SIZE];
+      auto count = queue.try_dequeue_bulk_from_producer(
+          ptok, entries, std::min(BULK_DEQUEUE_SIZE, free_slots.size()));
+      num_files_dequeued += count;
+      for (std::size_t j = 0; j < count; ++j) {
+        const auto index = free_slots.back();
+        free_slots.pop_back();
+        slots[index].filename = entries[j];
+        const auto user_data = (index << REQUEST_BITS) | OPEN;
+        if (ring.openat(AT_FDCWD, entries[j], O_RDONLY, user_data)) {
+          ++num_requests_in_flight;
+        } else {
+          finish_blocking(user_data);
+        }
+      }
+    }
+
+    if (num_requests_in_flight == 0) {
+      if (ring_failed) {
+        return false;
+      }
+      if (!running && num_files_dequeued == num_files_enqueued) {
+        break;
+      }
+      if (options.governor) {
+        options.governor->throttle_cpu();
+      }
+      continue;
+    }
+
+    const auto submitted = ring.submit_and_wait();
+    if (submitted == -EAGAIN || (ring_failed && submitted < 0)) {
+      std::this_thread::yield();
+    } else if (submitted < 0 && submitted != -EBUSY) {
+      // Nothing queued is submitted any more, what was submitted is still
+      // waited for
+      std::cerr << "io_uring: " << std::strerror(-submitted) << " (os error "
+                << -submitted << "), falling back to blocking reads\n";
+      ring_failed = true;
+      std::uint64_t user_data{0};
+      while (ring.take_queued(user_data)) {
+        --num_requests_in_flight;
+        finish_blocking(user_data);
+      }
+    }
+
+    std::uint64_t user_data{0};
+    int ret{0};
+    while (ring.next_completion(user_data, ret)) {
+      --num_requests_in_flight;
+      const auto request = user_data & ((1 << REQUEST_BITS) - 1);
+      const auto index = user_data >> REQUEST_BITS;
+      if (request == CLOSE) {
+        continue;
+      }
+
+      auto &s = slots[index];
+      if (request == OPEN) {
+        if (ret < 0) {
+          std::cerr << s.filename << ": " << std::strerror(-ret)
+                    << " (os error " << -ret << ")\n";
+          free_slots.push_back(index);
+          continue;
+        }
+        s.fd = ret;
+        const auto read_data = (index << REQUEST_BITS) | READ;
+        if (!ring_failed && ring.read(s.fd, s.buffer.get(), FILE_CHUNK_SIZE,
+                                      0, read_data)) {
+          ++num_requests_in_flight;
+        } else {
+          finish_blocking(read_data);
+        }
+      } else {
+        if (ret > 0 && options.governor) {
+          options.governor->pace(ret);
+        }
+        // On a read error, the search reads the file again itself
+        search_file(s.fd, s.filename,
+                    ret > 0 ? std::string_view(s.buffer.get(), ret)
+                            : std::string_view{},
+                    local_scratch, stream, reader, lines, nullptr);
+        const auto close_data =
+            (static_cast<std::uint64_t>(s.fd) << REQUEST_BITS) | CLOSE;
+        if (!ring_failed && ring.close(s.fd, close_data)) {
+          ++num_requests_in_flight;
+        } else {
+          finish_blocking(close_data);
+        }
+        free_slots.push_back(index);
+      }
+    }
+  }
+  return true;
+}
+
 void git_index_search::run(std::filesystem::path path) {
   if (!libgit2_initialized) {
     git_libgit2_init();
@@ -103,13 +340,25 @@ void git_index_search::run(std::filesystem::path path) {
     }
   }
 
+  if (visited_files && options.report_aliases) {
+    visited_files->print_aliases(options.is_stdout);
+  }
+
   // Process submodules
   const auto current_path = std::filesystem::current_path();
-  for (const auto &sm_path : submodule_paths) {
+  for (const auto &[sm_path, sm_depth] : submodules) {
     git_index_search git_index_searcher(
-        database, scratch, file_filter_database, file_filter_scratch, options,
+        database, stream_database, scratch, file_filter_database,
+        file_filter_scratch, options,
         basepath /
             std::filesystem::relative(std::filesystem::canonical(sm_path)));
+    git_index_searcher.glob_prefix =
+        glob_prefix + sm_path.lexically_normal().string() + "/";
+    git_index_searcher.directory_prefix =
+        directory_prefix + sm_path.lexically_normal().string() + "/";
+    git_index_searcher.prune_directories(directory_filter_database,
+                                         directory_filter_scratch, sm_depth,
+                                         root_device);
     if (chdir(sm_path.c_str()) == 0) {
       git_index_searcher.run(".");
       if (chdir(current_path.c_str()) != 0) {
@@ -119,63 +368,257 @@ void git_index_search::run(std::filesystem::path path) {
   }
 }
 
+bool git_index_search::enumerate(
+    const std::function<void(std::string &&)> &visitor) {
+  file_visitor = &visitor;
+  const auto result = visit_git_repo(basepath);
+  file_visitor = nullptr;
+
+  // Submodule paths are already relative to the current directory
+  for (const auto &[sm_path, sm_depth] : submodules) {
+    git_index_search git_index_searcher(
+        database, stream_database, scratch, file_filter_database,
+        file_filter_scratch, options, sm_path);
+    git_index_searcher.prune_directories(directory_filter_database,
+                                         directory_filter_scratch, sm_depth,
+                                         root_device);
+    git_index_searcher.enumerate(visitor);
+  }
+
+  return result;
+}
+
+void git_index_search::prune_directories(
+    hs_database_t *directory_filter_database,
+    hs_scratch_t *directory_filter_scratch, std::size_t depth, dev_t device) {
+  this->directory_filter_database = directory_filter_database;
+  this->directory_filter_scratch = directory_filter_scratch;
+  base_depth = depth;
+  root_device = device;
+}
+
+bool git_index_search::prune_directory(std::string_view directory) {
+  // The files of a directory at depth d are at depth d + 1
+  const std::size_t depth =
+      base_depth +
+      (directory.empty()
+           ? 0
+           : std::count(directory.begin(), directory.end(), '/') + 1);
+  if (options.max_depth.has_value() && depth + 1 > options.max_depth.value()) {
+    return true;
+  }
+
+  if ((!directory_filter_database && !options.one_file_system) ||
+      directory.empty() || directory == checked_directory) {
+    return false;
+  }
+  if (!pruned_directory.empty() &&
+      directory.substr(0, pruned_directory.size()) == pruned_directory &&
+      (directory.size() == pruned_directory.size() ||
+       directory[pruned_directory.size()] == '/')) {
+    return true;
+  }
+
+  // Check each component, up to the whole directory, unless the previous
+  // directory already went through it
+  std::size_t end{0};
+  while (end != directory.size()) {
+    end = directory.find('/', end + 1);
+    if (end == std::string_view::npos) {
+      end = directory.size();
+    }
+    const auto component = directory.substr(0, end);
+    if (checked_directory.size() >= end &&
+        checked_directory.compare(0, end, component) == 0 &&
+        (checked_directory.size() == end || checked_directory[end] == '/')) {
+      continue;
+    }
+
+    if (options.one_file_system) {
+      // Relative to the current directory, like the entries are opened
+      directory_path.clear();
+      if (file_visitor) {
+        directory_path = basepath.string();
+        if (!directory_path.empty() && directory_path.back() != '/') {
+          directory_path += '/';
+        }
+      }
+      directory_path += component;
+
+      // Don't trigger an automount just to find out it's another
+      // filesystem. With -L, the target of a symlink is what matters
+      const int flags = AT_NO_AUTOMOUNT |
+                        (options.follow_symlinks ? 0 : AT_SYMLINK_NOFOLLOW);
+      struct stat sb;
+      if (fstatat(AT_FDCWD, directory_path.c_str(), &sb, flags) == -1 ||
+          sb.st_dev != root_device) {
+        pruned_directory = component;
+        return true;
+      }
+    }
+
+    if (directory_filter_database) {
+      directory_path = directory_prefix;
+      directory_path += component;
+      if (exclude_directory(directory_path.data(), directory_path.size(),
+                            directory_filter_database,
+                            directory_filter_scratch)) {
+        pruned_directory = component;
+        return true;
+      }
+    }
+  }
+
+  checked_directory = directory;
+  return false;
+}
+
 bool git_index_search::process_file(const char *filename,
-                                    hs_scratch_t *local_scratch, char *buffer,
-                                    std::string &lines) {
+                                    hs_scratch_t *local_scratch,
+                                    chunk_stream &stream, chunk_reader &reader,
+                                    std::string &lines, file_batch *batch) {
+  // With --max-filesize, check the size before opening the file
+  struct stat sb;
+  if (options.max_file_size.has_value() && stat(filename, &sb) == 0 &&
+      static_cast<std::size_t>(sb.st_size) > options.max_file_size.value()) {
+    return false;
+  }
+
   int fd = open(filename, O_RDONLY, 0);
   if (fd == -1) {
     std::cerr << filename << ": " << std::strerror(errno) << " (os error " << errno << ")\n";
     return false;
   }
-  bool result{false};
 
+  const auto result = search_file(fd, filename, {}, local_scratch, stream,
+                                  reader, lines, batch);
+  close(fd);
+  return result;
+}
+
+bool git_index_search::search_file(int fd, const char *filename,
+                                   std::string_view first_read,
+                                   hs_scratch_t *local_scratch,
+                                   chunk_stream &stream, chunk_reader &reader,
+                                   std::string &lines, file_batch *batch) {
+  auto result_path = basepath / filename;
+
+  // The size decides how the file is read
+  struct stat file_stat{};
+  if (fstat(fd, &file_stat) == -1) {
+    std::cerr << filename << ": " << std::strerror(errno) << " (os error "
+              << errno << ")\n";
+    return false;
+  }
+  const std::size_t file_size = file_stat.st_size;
+  if (options.max_file_size.has_value() &&
+      file_size > options.max_file_size.value()) {
+    return false;
+  }
+
+  // With --shard, a large file is searched by every shard, each scanning
+  // its own chunks, and a small file by one shard only. This is decided
+  // before the inode is deduplicated, see inode_shard_key.
+  auto shard_path = visited_files && options.shard
+                        ? inode_shard_key(file_stat.st_ino)
+                        : glob_prefix + filename;
+  if (options.shard && file_size <= LARGE_FILE_SIZE &&
+      !in_shard(*options.shard, shard_path)) {
+    return false;
+  }
+
+  // Search each inode only once, e.g., a file and a symlink to it
+  if (visited_files &&
+      !visited_files->insert(file_stat.st_dev, file_stat.st_ino,
+                             result_path.native())) {
+    return false;
+  }
+
+  // A large file is memory mapped and searched in parallel chunks
+  if (file_size > LARGE_FILE_SIZE) {
+    large_file_searcher->run(result_path, file_size, std::move(shard_path),
+                             fd);
+    return false;
+  }
+
+  // A tiny file waits in the batch, see search_batch
+  if (batch && file_size <= TINY_FILE_SIZE) {
+    if (!batch->has_room(file_size)) {
+      search_batch(*batch, local_scratch, stream, reader, lines);
+    }
+    if (batch->read_file(fd, filename, file_stat)) {
+      return false;
+    }
+  }
+
+  // Anything more than a chunk is read front to back
+  if (file_size > FILE_CHUNK_SIZE) {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  }
+
+  return scan_file(fd, filename, first_read, file_stat, local_scratch, stream,
+                   reader, lines);
+}
+
+void git_index_search::search_batch(file_batch &batch,
+                                    hs_scratch_t *local_scratch,
+                                    chunk_stream &stream, chunk_reader &reader,
+                                    std::string &lines) {
+  batch.scan(database, local_scratch,
+             [&](const void *file, const struct stat &file_stat,
+                 std::string_view data) {
+               scan_file(-1, static_cast<const char *>(file), data, file_stat,
+                         local_scratch, stream, reader, lines);
+             });
+}
+
+bool git_index_search::scan_file(int fd, const char *filename,
+                                 std::string_view first_read,
+                                 const struct stat &file_stat,
+                                 hs_scratch_t *local_scratch,
+                                 chunk_stream &stream, chunk_reader &reader,
+                                 std::string &lines) {
   const auto process_fn =
       (options.is_stdout || options.print_only_matching_parts ||
        options.show_column_numbers || options.show_byte_offset)
           ? process_matches
           : process_matches_nocolor_nostdout;
   auto result_path = basepath / filename;
+  const std::size_t file_size = file_stat.st_size;
+
+  bool result{false};
 
   // Process the file in chunks
-  std::size_t total_bytes_read = 0;
-  bool max_file_size_provided = options.max_file_size.has_value();
-  std::size_t max_file_size =
-      max_file_size_provided ? options.max_file_size.value() : 0;
-  std::size_t bytes_read = 0;
   std::atomic<std::size_t> max_line_number{0};
   std::size_t current_line_number{1};
   std::size_t num_matching_lines{0};
   std::size_t num_matches{0};
 
   // Read the file in chunks and perform search
+  // The stream carries matches across chunks, and across the pieces of a
+  // long line
+  reader.reset(fd, first_read, file_size,
+               fd != -1 ? options.device_limits->classify(fd, file_stat.st_dev)
+                        : device_class::local);
+  stream.reset();
+  std::string_view chunk{};
+  long_line_matches long_line{};
   bool first{true};
   while (true) {
 
-    auto ret = read(fd, buffer, FILE_CHUNK_SIZE);
-
-    if (ret > 0) {
-      bytes_read = ret;
-    } else {
+    const auto status = reader.next(chunk);
+    if (status == chunk_reader::status::end_of_file) {
       break;
     }
 
-    total_bytes_read += bytes_read;
-
-    if (max_file_size_provided && total_bytes_read > max_file_size) {
-      // File size limit reached
-      close(fd);
-      lines.clear();
-      return false;
-    }
-
     if (first) {
       first = false;
-      if (starts_with_magic_bytes(buffer, bytes_read)) {
+      if (starts_with_magic_bytes(chunk.data(), chunk.size())) {
         result = false;
         break;
       }
 
-      if (has_null_bytes(buffer, bytes_read)) {
+      if (has_null_bytes(chunk.data(), chunk.size())) {
         // NULL bytes found
         // Ignore file
         // Could be a .exe, .gz, .bin etc.
@@ -184,35 +627,12 @@ bool git_index_search::process_file(const char *filename,
       }
     }
 
-    // Detect end of file
-    // If end of file, search entire chunk
-    // If not end of file, search for last newline
-    const auto last_chunk = (bytes_read < FILE_CHUNK_SIZE);
-    std::size_t search_size = bytes_read;
-
-    char *last_newline = buffer + bytes_read;
-    if (!last_chunk) {
-      // Find the position of the last newline in the buffer
-      // In order to catch matches between chunks, need to amend the buffer
-      // and make sure it stops at a new line boundary
-      char *last_newline = (char *)memrchr(buffer, '\n', bytes_read);
-      if (last_newline) {
-        search_size = last_newline - buffer;
-      } else {
-        // Not a single newline in the entire chunk
-        // This could be some binary file or some minified JS file
-        // Skip it
-        result = false;
-        break;
-      }
-    }
-
     std::vector<std::pair<unsigned long long, unsigned long long>> matches{};
     std::atomic<size_t> number_of_matches = 0;
     file_context ctx{number_of_matches, matches, options.print_only_filenames};
 
-    if (hs_scan(database, buffer, search_size, 0, local_scratch, on_match,
-                (void *)(&ctx)) != HS_SUCCESS) {
+    if (stream.scan(local_scratch, chunk, reader.chunk_offset(),
+                    reader.done(), ctx) != HS_SUCCESS) {
       if (options.print_only_filenames && ctx.number_of_matches > 0) {
         result = true;
       } else {
@@ -225,41 +645,38 @@ bool git_index_search::process_file(const char *filename,
       }
     }
 
-    if (ctx.number_of_matches > 0) {
+    const std::size_t chunk_line_number = current_line_number;
+    if (status == chunk_reader::status::line_piece) {
+      long_line.add_piece(chunk, chunk_line_number, ctx.number_of_matches);
+      num_matches += ctx.number_of_matches;
+    } else if (long_line.in_line) {
+      num_matching_lines += long_line.finish(
+          lines, result_path.c_str(), options.print_filenames,
+          options.is_stdout, options.show_line_numbers);
+    }
+
+    if (status == chunk_reader::status::chunk && ctx.number_of_matches > 0) {
       num_matching_lines += process_fn(
-          result_path.c_str(), buffer, search_size, ctx.matches,
-          current_line_number, lines, options.print_filenames,
+          result_path.c_str(), chunk.data(), chunk.size(),
+          ctx.matches, current_line_number, lines, options.print_filenames,
           options.is_stdout, options.show_line_numbers,
           options.show_column_numbers, options.show_byte_offset,
           options.print_only_matching_parts, options.max_column_limit,
-          total_bytes_read - bytes_read, options.ltrim_each_output_line);
+          reader.chunk_offset(), options.ltrim_each_output_line);
       num_matches += ctx.number_of_matches;
     }
 
-    if (!last_chunk) {
-
-      if (static_cast<std::size_t>(last_newline - buffer) == bytes_read - 1) {
-        // Chunk ends exactly at the newline
-        // Do nothing
-      } else {
-        // Backtrack "remainder" number of characters
-        if ((bytes_read - search_size) < FILE_CHUNK_SIZE) {
-          lseek(fd, -1 * (bytes_read - search_size), SEEK_CUR);
-        } else {
-          // Don't lseek back the entire chunk
-          // because that's an infinite loop
-
-          // Not a single newline in the entire chunk
-          // This could be some binary file or some minified JS file
-          // Skip it
-          result = false;
-          break;
-        }
-      }
+    // The next chunk starts where this one ended, not at the last match
+    if (options.show_line_numbers) {
+      current_line_number =
+          chunk_line_number + std::count(chunk.begin(), chunk.end(), '\n');
     }
   }
 
-  close(fd);
+  // The file may end with a long line
+  num_matching_lines += long_line.finish(
+      lines, result_path.c_str(), options.print_filenames, options.is_stdout,
+      options.show_line_numbers);
 
   if ((result || options.count_include_zeros) && options.count_matching_lines &&
       !options.print_only_filenames) {
@@ -314,6 +731,10 @@ bool git_index_search::process_file(const char *filename,
     }
   }
 
+  if (result && visited_files) {
+    visited_files->mark_matched(file_stat.st_dev, file_stat.st_ino);
+  }
+
   lines.clear();
   return result;
 }
@@ -340,8 +761,12 @@ bool git_index_search::search_submodules(const char *dir,
             auto dir = ctx->dir;
 
             auto path = std::filesystem::path(dir) / name;
-            if (std::filesystem::exists(path / ".git")) {
-              self->submodule_paths.push_back(path);
+            if (self->prune_directory(name)) {
+              // Pruned like any other directory of the index
+            } else if (std::filesystem::exists(path / ".git")) {
+              self->submodules.push_back(
+                  {path, self->base_depth +
+                             std::count(name, name + strlen(name), '/') + 1});
             } else {
               // submodule not recursively cloned
               // ignore
@@ -358,6 +783,24 @@ bool git_index_search::search_submodules(const char *dir,
 
 bool git_index_search::visit_git_index(const std::filesystem::path &,
                                        git_index *index) {
+  if (!file_type_scratch &&
+      !options.file_types->alloc_scratch(&file_type_scratch)) {
+    return false;
+  }
+
+  // When enumerating for directory_search, it applies --glob itself
+  const bool apply_globs = options.globs && !file_visitor;
+  if (apply_globs && !glob_scratch &&
+      !options.globs->alloc_scratch(&glob_scratch)) {
+    return false;
+  }
+  std::string glob_path{glob_prefix};
+
+  // --exclude-dir, --max-depth and --one-file-system
+  const bool prune_directories_enabled = directory_filter_database ||
+                                         options.max_depth.has_value() ||
+                                         options.one_file_system;
+
   git_index_iterator *iter{nullptr};
   if (git_index_iterator_new(&iter, index) == 0) {
 
@@ -369,15 +812,49 @@ bool git_index_search::visit_git_index(const std::filesystem::path &,
       if (entry &&
           (!options.filter_files ||
            (options.filter_files &&
-            filter_file(entry->path, file_filter_database, file_filter_scratch,
+            filter_file(entry->path, strlen(entry->path),
+                        file_filter_database, file_filter_scratch,
                         options.negate_filter)))) {
 
         // Skip directories and symlinks
-        if ((entry->mode & S_IFMT) == S_IFDIR ||
-            (entry->mode & S_IFMT) == S_IFLNK) {
+        // With -L, symlinks to regular files are searched
+        if ((entry->mode & S_IFMT) == S_IFDIR) {
+          continue;
+        }
+        if ((entry->mode & S_IFMT) == S_IFLNK) {
+          const auto target = file_visitor ? (basepath / entry->path)
+                                           : std::filesystem::path(entry->path);
+          struct stat sb;
+          if (!options.follow_symlinks || stat(target.c_str(), &sb) == -1 ||
+              !S_ISREG(sb.st_mode)) {
+            continue;
+          }
+        }
+
+        if (!options.file_types->accept(entry->path, strlen(entry->path),
+                                        file_type_scratch)) {
           continue;
         }
 
+        if (prune_directories_enabled) {
+          std::string_view path(entry->path);
+          const auto it = path.find_last_of('/');
+          if (prune_directory(it != std::string_view::npos
+                                  ? path.substr(0, it)
+                                  : std::string_view{})) {
+            continue;
+          }
+        }
+
+        if (apply_globs) {
+          glob_path.resize(glob_prefix.size());
+          glob_path += entry->path;
+          if (!options.globs->accept(glob_path.data(), glob_path.size(),
+                                     glob_scratch)) {
+            continue;
+          }
+        }
+
         if (!options.search_hidden_files) {
           if (entry->path[0] == '.') {
             continue;
@@ -392,7 +869,9 @@ bool git_index_search::visit_git_index(const std::filesystem::path &,
           }
         }
 
-        if (options.perform_search) {
+        if (file_visitor) {
+          (*file_visitor)((basepath / entry->path).string());
+        } else if (options.perform_search) {
           queue.enqueue(ptok, entry->path);
           ++num_files_enqueued;
         } else {
@@ -419,6 +898,14 @@ bool git_index_search::visit_git_index(const std::filesystem::path &,
             }
           }
 
+          if (options.shard) {
+            glob_path.resize(glob_prefix.size());
+            glob_path += entry->path;
+            if (!in_shard(*options.shard, glob_path)) {
+              continue;
+            }
+          }
+
           if (options.is_stdout) {
             fmt::print(fg(fmt::color::steel_blue), "./{}\n", entry->path);
           } else {
@@ -469,15 +956,20 @@ bool git_index_search::visit_git_repo(const std::filesystem::path &dir,
 }
 
 bool git_index_search::try_dequeue_and_process_path(hs_scratch_t *local_scratch,
-                                                    char *buffer,
-                                                    std::string &lines) {
+                                                    chunk_stream &stream,
+                                                    chunk_reader &reader,
+                                                    std::string &lines,
+                                                    file_batch *batch) {
   constexpr std::size_t BULK_DEQUEUE_SIZE = 32;
   const char *entries[BULK_DEQUEUE_SIZE];
   auto count =
       queue.try_dequeue_bulk_from_producer(ptok, entries, BULK_DEQUEUE_SIZE);
   if (count > 0) {
     for (std::size_t j = 0; j < count; ++j) {
-      process_file(entries[j], local_scratch, buffer, lines);
+      process_file(entries[j], local_scratch, stream, reader, lines, batch);
+    }
+    if (batch) {
+      search_batch(*batch, local_scratch, stream, reader, lines);
     }
     num_files_dequeued += count;
     return true;
@@ -0,0 +1,121 @@
+#include <cctype>
+#include <hypergrep/glob.hpp>
+
+namespace {
+
+void append_literal(char c, std::string &regex) {
+  if (static_cast<unsigned char>(c) < 0x80 && c != '/' &&
+      !std::isalnum(static_cast<unsigned char>(c))) {
+    regex += '\\';
+  }
+  regex += c;
+}
+
+// Translate `[...]` starting at glob[i]
+// Returns the index after the closing ']', or i if the class isn't closed
+std::size_t append_class(std::string_view glob, std::size_t i,
+                         std::string &regex) {
+  auto start = i + 1;
+  bool negated{false};
+  if (start < glob.size() && (glob[start] == '!' || glob[start] == '^')) {
+    negated = true;
+    start += 1;
+  }
+
+  // A ']' right after the opening bracket is part of the class
+  auto end = start;
+  if (end < glob.size() && glob[end] == ']') {
+    end += 1;
+  }
+  end = glob.find(']', end);
+  if (end == std::string_view::npos) {
+    return i;
+  }
+
+  regex += negated ? "[^/" : "[";
+  for (auto j = start; j < end; ++j) {
+    const char c = glob[j];
+    if (c == '-') {
+      regex += c;
+    } else {
+      append_literal(c, regex);
+    }
+  }
+  regex += ']';
+  return end + 1;
+}
+
+} // namespace
+
+std::string glob_to_regex(std::string_view glob) {
+  std::string regex{};
+  regex.reserve(glob.size() * 2 + 8);
+
+  if (!glob.empty() && glob[0] == '/') {
+    regex += '^';
+    glob.remove_prefix(1);
+  } else if (glob.find('/') != std::string_view::npos) {
+    regex += '^';
+  } else {
+    // No slash, match the name at any depth
+    regex += "(?:^|/)";
+  }
+
+  std::size_t i{0};
+  while (i < glob.size()) {
+    const char c = glob[i];
+
+    if (c == '*' && i + 1 < glob.size() && glob[i + 1] == '*') {
+      const bool after_slash = (i == 0 || glob[i - 1] == '/');
+      if (after_slash && i + 2 < glob.size() && glob[i + 2] == '/') {
+        // `**/` matches zero or more directories
+        regex += "(?:.*/)?";
+        i += 3;
+      } else if (after_slash && i + 2 == glob.size()) {
+        // Trailing `/**` matches everything inside
+        regex += ".*";
+        i += 2;
+      } else {
+        // Any other `**` is an ordinary `*`
+        regex += "[^/]*";
+        i += 2;
+      }
+      continue;
+    }
+
+    switch (c) {
+    case '*':
+      regex += "[^/]*";
+      i += 1;
+      break;
+    case '?':
+      regex += "[^/]";
+      i += 1;
+      break;
+    case '[': {
+      const auto next = append_class(glob, i, regex);
+      if (next == i) {
+        append_literal(c, regex);
+        i += 1;
+      } else {
+        i = next;
+      }
+      break;
+    }
+    case '\\':
+      if (i + 1 < glob.size()) {
+        i += 1;
+      }
+      append_literal(glob[i], regex);
+      i += 1;
+      break;
+    default:
+      append_literal(c, regex);
+      i += 1;
+      break;
+    }
+  }
+
+  regex += '$';
+  return regex;
+}
@@ -0,0 +1,244 @@
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <hypergrep/constants.hpp>
+#include <hypergrep/glob.hpp>
+#include <hypergrep/ignore_rules.hpp>
+#include <unistd.h>
+
+namespace {
+
+struct ignore_match_context {
+  const ignore_rules *level{nullptr};
+  bool is_directory{false};
+  long long last_match{-1};
+};
+
+bool starts_with(std::string_view str, std::string_view prefix) {
+  return str.size() >= prefix.size() &&
+         str.compare(0, prefix.size(), prefix) == 0;
+}
+
+} // namespace
+
+std::size_t ignore_rules::file_index(const char *name) {
+  for (std::size_t i = 0; i < NUM_FILE_NAMES; ++i) {
+    if (strcmp(name, FILE_NAMES[i]) == 0) {
+      return i;
+    }
+  }
+  return NUM_FILE_NAMES;
+}
+
+ignore_rules::ignore_rules(const ignore_rules *parent,
+                           std::size_t base_length)
+    : parent(parent), base_length(base_length) {}
+
+ignore_rules::~ignore_rules() {
+  if (database) {
+    hs_free_database(database);
+  }
+}
+
+void ignore_rules::add_file(int directory_fd, std::size_t index) {
+  int fd = openat(directory_fd, FILE_NAMES[index], O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return;
+  }
+
+  std::string contents{};
+  char buffer[TYPICAL_FILESYSTEM_BLOCK_SIZE];
+  while (true) {
+    auto ret = read(fd, buffer, sizeof(buffer));
+    if (ret <= 0) {
+      break;
+    }
+    contents.append(buffer, ret);
+  }
+  close(fd);
+
+  const bool is_hgignore = (index == 1);
+  bool is_glob_syntax{false};
+
+  std::string_view remaining(contents);
+  while (!remaining.empty()) {
+    auto end = remaining.find('\n');
+    auto line = remaining.substr(0, end);
+    remaining.remove_prefix(end == std::string_view::npos ? remaining.size()
+                                                          : end + 1);
+    if (!line.empty() && line.back() == '\r') {
+      line.remove_suffix(1);
+    }
+
+    if (is_hgignore) {
+      add_hgignore_line(line, is_glob_syntax);
+    } else {
+      add_gitignore_line(line);
+    }
+  }
+}
+
+void ignore_rules::add_gitignore_line(std::string_view line) {
+  if (line.empty() || line[0] == '#') {
+    return;
+  }
+
+  // Trailing spaces are ignored unless escaped
+  while (!line.empty() && line.back() == ' ' &&
+         !(line.size() > 1 && line[line.size() - 2] == '\\')) {
+    line.remove_suffix(1);
+  }
+
+  rule r{};
+  if (!line.empty() && line[0] == '!') {
+    r.negated = true;
+    line.remove_prefix(1);
+  }
+
+  if (!line.empty() && line.back() == '/') {
+    r.directory_only = true;
+    line.remove_suffix(1);
+  }
+
+  if (line.empty()) {
+    return;
+  }
+
+  patterns.push_back(glob_to_regex(line));
+  rules.push_back(r);
+}
+
+void ignore_rules::add_hgignore_line(std::string_view line,
+                                     bool &is_glob_syntax) {
+  // Mercurial defaults to regular expressions. `syntax:` switches the
+  // rest of the file, and a `glob:` or `re:` prefix a single line.
+  if (line.empty() || line[0] == '#') {
+    return;
+  }
+
+  if (starts_with(line, "syntax:")) {
+    line.remove_prefix(7);
+    while (!line.empty() && line[0] == ' ') {
+      line.remove_prefix(1);
+    }
+    is_glob_syntax = (line == "glob");
+    return;
+  }
+
+  bool is_glob = is_glob_syntax;
+  if (starts_with(line, "glob:")) {
+    is_glob = true;
+    line.remove_prefix(5);
+  } else if (starts_with(line, "re:")) {
+    is_glob = false;
+    line.remove_prefix(3);
+  }
+
+  if (line.empty()) {
+    return;
+  }
+
+  if (is_glob) {
+    // Mercurial globs match at any depth
+    patterns.push_back(line[0] == '/'
+                           ? glob_to_regex(line)
+                           : glob_to_regex("**/" + std::string(line)));
+  } else {
+    patterns.emplace_back(line);
+  }
+  rules.push_back(rule{});
+}
+
+bool ignore_rules::compile(std::string_view directory_path) {
+  while (!patterns.empty()) {
+    std::vector<const char *> patterns_c;
+    std::vector<unsigned int> flags;
+    std::vector<unsigned int> ids;
+    patterns_c.reserve(patterns.size());
+    flags.reserve(patterns.size());
+    ids.reserve(patterns.size());
+    for (std::size_t i = 0; i < patterns.size(); ++i) {
+      patterns_c.push_back(patterns[i].c_str());
+      // Paths aren't guaranteed to be valid UTF-8, so match bytes
+      flags.push_back(HS_FLAG_DOTALL | HS_FLAG_ALLOWEMPTY |
+                      HS_FLAG_SINGLEMATCH);
+      ids.push_back(i);
+    }
+
+    hs_compile_error_t *compile_error = NULL;
+    auto error_code = hs_compile_multi(
+        patterns_c.data(), flags.data(), ids.data(), patterns.size(),
+        HS_MODE_BLOCK, NULL, &database, &compile_error);
+    if (error_code == HS_SUCCESS) {
+      break;
+    }
+
+    const auto expression = compile_error->expression;
+    if (expression < 0 ||
+        static_cast<std::size_t>(expression) >= patterns.size()) {
+      fprintf(stderr, "%.*s: Error compiling ignore rules: %s\n",
+              static_cast<int>(directory_path.size()), directory_path.data(),
+              compile_error->message);
+      hs_free_compile_error(compile_error);
+      database = nullptr;
+      patterns.clear();
+      rules.clear();
+      break;
+    }
+
+    // Drop the offending rule and try again with the rest
+    fprintf(stderr, "%.*s: Skipping ignore pattern '%s': %s\n",
+            static_cast<int>(directory_path.size()), directory_path.data(),
+            patterns[expression].c_str(), compile_error->message);
+    hs_free_compile_error(compile_error);
+    patterns.erase(patterns.begin() + expression);
+    rules.erase(rules.begin() + expression);
+  }
+
+  return database != nullptr;
+}
+
+bool ignore_rules::alloc_scratch(hs_scratch_t **scratch) const {
+  for (auto level = this; level; level = level->parent) {
+    if (level->database &&
+        hs_alloc_scratch(level->database, scratch) != HS_SUCCESS) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int ignore_rules::on_match(unsigned int id, unsigned long long,
+                           unsigned long long, unsigned int, void *ctx) {
+  auto mctx = static_cast<ignore_match_context *>(ctx);
+  const auto &rules = mctx->level->rules;
+  if (rules[id].directory_only && !mctx->is_directory) {
+    return 0;
+  }
+  if (static_cast<long long>(id) > mctx->last_match) {
+    mctx->last_match = id;
+  }
+  // Nothing can override the last rule
+  return (id + 1 == rules.size()) ? 1 : 0;
+}
+
+bool ignore_rules::is_ignored(std::string_view path, bool is_directory,
+                              hs_scratch_t *scratch) const {
+  for (auto level = this; level; level = level->parent) {
+    if (!level->database || path.size() <= level->base_length) {
+      continue;
+    }
+
+    ignore_match_context ctx{};
+    ctx.level = level;
+    ctx.is_directory = is_directory;
+    hs_scan(level->database, path.data() + level->base_length,
+            path.size() - level->base_length, 0, scratch, on_match, &ctx);
+
+    // The deepest directory with a matching rule decides
+    if (ctx.last_match >= 0) {
+      return !level->rules[ctx.last_match].negated;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,63 @@
+#include <fmt/color.h>
+#include <fmt/format.h>
+#include <hypergrep/inode_set.hpp>
+
+inode_set::inode_set(bool keep_aliases) : keep_aliases(keep_aliases) {}
+
+bool inode_set::insert(dev_t device, ino_t inode, std::string_view path) {
+  const key k{device, inode};
+  auto &s = shard_for(k);
+  std::lock_guard<std::mutex> lock(s.mutex);
+
+  auto [it, inserted] = s.inodes.try_emplace(k);
+  if (keep_aliases) {
+    if (inserted) {
+      it->second = std::make_unique<aliases>();
+      it->second->path = path;
+    } else {
+      it->second->other_paths.emplace_back(path);
+    }
+  }
+  return inserted;
+}
+
+void inode_set::mark_matched(dev_t device, ino_t inode) {
+  if (!keep_aliases) {
+    return;
+  }
+
+  const key k{device, inode};
+  auto &s = shard_for(k);
+  std::lock_guard<std::mutex> lock(s.mutex);
+  auto it = s.inodes.find(k);
+  if (it != s.inodes.end()) {
+    it->second->matched = true;
+  }
+}
+
+void inode_set::print_aliases(bool is_stdout) const {
+  for (const auto &s : shards) {
+    std::lock_guard<std::mutex> lock(s.mutex);
+    for (const auto &[k, a] : s.inodes) {
+      if (!a || !a->matched) {
+        continue;
+      }
+      for (const auto &other_path : a->other_paths) {
+        if (is_stdout) {
+          fmt::print("{} -> {}\n",
+                     fmt::format(fg(fmt::color::steel_blue), "{}", other_path),
+                     fmt::format(fg(fmt::color::steel_blue), "{}", a->path));
+        } else {
+          fmt::print("{} -> {}\n", other_path, a->path);
+        }
+      }
+    }
+  }
+}
+
+void inode_set::clear() {
+  for (auto &s : shards) {
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.inodes.clear();
+  }
+}
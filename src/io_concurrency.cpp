@@ -0,0 +1,162 @@
+#include <charconv>
+#include <cstdio>
+#include <hypergrep/io_concurrency.hpp>
+#include <stdexcept>
+#include <string>
+#include <sys/statfs.h>
+#include <sys/sysmacros.h>
+
+namespace {
+
+// Default limits, indexed by device_class
+constexpr std::array<std::size_t, NUM_DEVICE_CLASSES> DEFAULT_LIMITS{0, 2, 8};
+
+constexpr std::array<std::string_view, NUM_DEVICE_CLASSES> CLASS_NAMES{
+    "local", "rotational", "network"};
+
+// From linux/magic.h, and the filesystems (FUSE, Lustre) it doesn't list
+constexpr unsigned long NETWORK_FILESYSTEMS[] = {
+    0x6969,     // NFS
+    0x517B,     // SMB
+    0xFF534D42, // CIFS
+    0xFE534D42, // SMB2
+    0x65735546, // FUSE
+    0x00C36400, // Ceph
+    0x01021997, // 9P
+    0x5346414F, // AFS
+    0x6B414653, // kAFS
+    0x0BD00BD0, // Lustre
+    0x01161970, // GFS2
+};
+
+bool is_network_filesystem(int fd) {
+  struct statfs sb {};
+  if (fstatfs(fd, &sb) == -1) {
+    return false;
+  }
+  const auto magic = static_cast<unsigned long>(sb.f_type) & 0xFFFFFFFFul;
+  for (const auto network_magic : NETWORK_FILESYSTEMS) {
+    if (magic == network_magic) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// A partition has no queue of its own, its disk (the parent) does
+bool is_rotational(dev_t device) {
+  const auto major_number = major(device);
+  const auto minor_number = minor(device);
+  if (major_number == 0) {
+    // Not backed by a block device (tmpfs, btrfs subvolumes, ...)
+    return false;
+  }
+  for (const auto format : {"/sys/dev/block/%u:%u/queue/rotational",
+                            "/sys/dev/block/%u:%u/../queue/rotational"}) {
+    char path[64];
+    std::snprintf(path, sizeof(path), format, major_number, minor_number);
+    if (auto file = std::fopen(path, "r")) {
+      const int c = std::fgetc(file);
+      std::fclose(file);
+      return c == '1';
+    }
+  }
+  return false;
+}
+
+bool parse_number(std::string_view str, std::size_t &value) {
+  const auto end = str.data() + str.size();
+  const auto [ptr, error] = std::from_chars(str.data(), end, value);
+  return error == std::errc{} && ptr == end;
+}
+
+} // namespace
+
+io_concurrency::slot::~slot() {
+  if (owner) {
+    owner->release(c);
+  }
+}
+
+io_concurrency::io_concurrency(
+    const std::array<std::size_t, NUM_DEVICE_CLASSES> &limits) {
+  for (std::size_t i = 0; i < NUM_DEVICE_CLASSES; ++i) {
+    classes[i].limit = limits[i];
+  }
+}
+
+device_class io_concurrency::classify(int fd, dev_t device) {
+  // Most files are on the same device as the one before
+  thread_local const io_concurrency *last_owner{nullptr};
+  thread_local dev_t last_device{0};
+  thread_local device_class last_class{device_class::local};
+  if (last_owner == this && last_device == device) {
+    return last_class;
+  }
+
+  device_class c{device_class::local};
+  {
+    std::lock_guard<std::mutex> lock(devices_mutex);
+    auto it = devices.find(device);
+    if (it != devices.end()) {
+      c = it->second;
+    } else if (fd != -1) {
+      c = is_network_filesystem(fd) ? device_class::network
+          : is_rotational(device)   ? device_class::rotational
+                                    : device_class::local;
+      devices.emplace(device, c);
+    } else {
+      return c;
+    }
+  }
+
+  last_owner = this;
+  last_device = device;
+  last_class = c;
+  return c;
+}
+
+io_concurrency::slot io_concurrency::acquire(device_class c) {
+  auto &state = classes[static_cast<std::size_t>(c)];
+  if (state.limit == 0) {
+    return slot{};
+  }
+
+  std::unique_lock<std::mutex> lock(state.mutex);
+  state.cv.wait(lock, [&state]() { return state.in_flight < state.limit; });
+  state.in_flight += 1;
+  return slot{this, c};
+}
+
+void io_concurrency::release(device_class c) {
+  auto &state = classes[static_cast<std::size_t>(c)];
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.in_flight -= 1;
+  }
+  state.cv.notify_one();
+}
+
+std::array<std::size_t, NUM_DEVICE_CLASSES>
+parse_io_concurrency(std::string_view spec) {
+  auto limits = DEFAULT_LIMITS;
+  while (!spec.empty()) {
+    const auto comma = spec.find(',');
+    const auto item = spec.substr(0, comma);
+    spec = comma == std::string_view::npos ? std::string_view{}
+                                           : spec.substr(comma + 1);
+
+    const auto equals = item.find('=');
+    std::size_t i{0};
+    while (i < NUM_DEVICE_CLASSES && item.substr(0, equals) != CLASS_NAMES[i]) {
+      ++i;
+    }
+    if (equals == std::string_view::npos || i == NUM_DEVICE_CLASSES ||
+        !parse_number(item.substr(equals + 1), limits[i])) {
+      throw std::runtime_error(
+          "Invalid --io-concurrency '" + std::string(item) +
+          "', expected local, rotational or network=<NUM>");
+    }
+  }
+  return limits;
+}
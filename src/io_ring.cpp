@@ -0,0 +1,214 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <hypergrep/io_ring.hpp>
+#include <iterator>
+#include <linux/io_uring.h>
+#include <memory>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+// Operations every io_ring is expected to support (Linux 5.6+)
+constexpr unsigned char REQUIRED_OPERATIONS[] = {
+    IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE};
+
+bool supports_required_operations(int ring_fd) {
+  constexpr unsigned MAX_PROBED_OPERATIONS = 256;
+  const auto size = sizeof(io_uring_probe) +
+                    MAX_PROBED_OPERATIONS * sizeof(io_uring_probe_op);
+  auto storage = std::make_unique<unsigned char[]>(size);
+  std::memset(storage.get(), 0, size);
+  auto probe = reinterpret_cast<io_uring_probe *>(storage.get());
+
+  if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE, probe,
+              MAX_PROBED_OPERATIONS) < 0) {
+    return false;
+  }
+  return std::all_of(std::begin(REQUIRED_OPERATIONS),
+                     std::end(REQUIRED_OPERATIONS), [probe](unsigned char op) {
+                       return op < probe->ops_len &&
+                              (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+                     });
+}
+
+template <typename T> T *at(void *base, std::size_t offset) {
+  return reinterpret_cast<T *>(static_cast<char *>(base) + offset);
+}
+
+} // namespace
+
+io_ring::io_ring(unsigned entries) {
+  io_uring_params params{};
+  int fd = syscall(__NR_io_uring_setup, entries, &params);
+  if (fd < 0) {
+    return;
+  }
+
+  sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_ring_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap) {
+    sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+  }
+
+  sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (sq_ring == MAP_FAILED) {
+    sq_ring = nullptr;
+    ::close(fd);
+    return;
+  }
+  if (single_mmap) {
+    cq_ring = sq_ring;
+  } else {
+    cq_ring = mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (cq_ring == MAP_FAILED) {
+      cq_ring = nullptr;
+      ::close(fd);
+      return;
+    }
+  }
+  sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+  void *sqes_mapping = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (sqes_mapping == MAP_FAILED) {
+    ::close(fd);
+    return;
+  }
+  sqes = static_cast<io_uring_sqe *>(sqes_mapping);
+
+  sq_head = at<unsigned>(sq_ring, params.sq_off.head);
+  sq_tail = at<unsigned>(sq_ring, params.sq_off.tail);
+  sq_array = at<unsigned>(sq_ring, params.sq_off.array);
+  sq_mask = *at<unsigned>(sq_ring, params.sq_off.ring_mask);
+  sq_entries = *at<unsigned>(sq_ring, params.sq_off.ring_entries);
+  cq_head = at<unsigned>(cq_ring, params.cq_off.head);
+  cq_tail = at<unsigned>(cq_ring, params.cq_off.tail);
+  cqes = at<io_uring_cqe>(cq_ring, params.cq_off.cqes);
+  cq_mask = *at<unsigned>(cq_ring, params.cq_off.ring_mask);
+
+  if (!supports_required_operations(fd)) {
+    ::close(fd);
+    return;
+  }
+  ring_fd = fd;
+}
+
+io_ring::~io_ring() {
+  if (sqes) {
+    munmap(sqes, sqes_size);
+  }
+  if (cq_ring && cq_ring != sq_ring) {
+    munmap(cq_ring, cq_ring_size);
+  }
+  if (sq_ring) {
+    munmap(sq_ring, sq_ring_size);
+  }
+  if (ring_fd != -1) {
+    ::close(ring_fd);
+  }
+}
+
+int io_ring::enter(unsigned to_submit, unsigned min_complete,
+                   unsigned flags) {
+  while (true) {
+    auto ret = syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete,
+                       flags, nullptr, 0);
+    if (ret >= 0) {
+      return ret;
+    }
+    if (errno != EINTR) {
+      return -errno;
+    }
+  }
+}
+
+io_uring_sqe *io_ring::next_sqe() {
+  if (queued() == sq_entries && enter(sq_entries, 0, 0) <= 0) {
+    return nullptr;
+  }
+
+  const auto tail = *sq_tail;
+  const auto index = tail & sq_mask;
+  auto sqe = &sqes[index];
+  std::memset(sqe, 0, sizeof(*sqe));
+  sq_array[index] = index;
+  __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+  return sqe;
+}
+
+bool io_ring::openat(int dirfd, const char *path, int flags,
+                     std::uint64_t user_data) {
+  auto sqe = next_sqe();
+  if (!sqe) {
+    return false;
+  }
+  sqe->opcode = IORING_OP_OPENAT;
+  sqe->fd = dirfd;
+  sqe->addr = reinterpret_cast<std::uint64_t>(path);
+  sqe->open_flags = flags;
+  sqe->user_data = user_data;
+  return true;
+}
+
+bool io_ring::read(int fd, char *buffer, unsigned size, std::uint64_t offset,
+                   std::uint64_t user_data) {
+  auto sqe = next_sqe();
+  if (!sqe) {
+    return false;
+  }
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<std::uint64_t>(buffer);
+  sqe->len = size;
+  sqe->off = offset;
+  sqe->user_data = user_data;
+  return true;
+}
+
+bool io_ring::close(int fd, std::uint64_t user_data) {
+  auto sqe = next_sqe();
+  if (!sqe) {
+    return false;
+  }
+  sqe->opcode = IORING_OP_CLOSE;
+  sqe->fd = fd;
+  sqe->user_data = user_data;
+  return true;
+}
+
+unsigned io_ring::queued() const {
+  return *sq_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+}
+
+int io_ring::submit_and_wait() {
+  return enter(queued(), 1, IORING_ENTER_GETEVENTS);
+}
+
+bool io_ring::take_queued(std::uint64_t &user_data) {
+  // Without SQPOLL, the kernel only looks at the queue when entered
+  if (queued() == 0) {
+    return false;
+  }
+  const auto tail = *sq_tail - 1;
+  user_data = sqes[sq_array[tail & sq_mask]].user_data;
+  __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+  return true;
+}
+
+bool io_ring::next_completion(std::uint64_t &user_data, int &result) {
+  const auto head = *cq_head;
+  if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+    return false;
+  }
+  const auto &cqe = cqes[head & cq_mask];
+  user_data = cqe.user_data;
+  result = cqe.res;
+  __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
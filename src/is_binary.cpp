@@ -63,7 +63,7 @@ bool starts_with_magic_bytes(const char *buffer, const std::size_t &) {
   return is_elf_header(buffer) || is_archive_header(buffer);
 }
 
-bool has_null_bytes(char *buffer, std::size_t search_size) {
+bool has_null_bytes(const char *buffer, std::size_t search_size) {
   if (memchr((void *)buffer, '\0', search_size) != NULL) {
     return true;
   }
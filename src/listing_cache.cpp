@@ -0,0 +1,304 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <fmt/format.h>
+#include <functional>
+#include <hypergrep/fnv1a.hpp>
+#include <hypergrep/listing_cache.hpp>
+#include <unistd.h>
+#include <unordered_set>
+
+namespace {
+
+constexpr std::string_view MAGIC = "hgrepLC1";
+
+// A directory changed this recently might change again within the same
+// timestamp tick, without its mtime and ctime moving. Such listings
+// aren't stored.
+constexpr std::int64_t RACY_INTERVAL_SECONDS = 2;
+
+// device, inode, mtime, ctime (seconds and nanoseconds),
+// then the lengths of the path and of the entries
+constexpr std::size_t RECORD_HEADER_SIZE = 6 * 8 + 2 * 4;
+
+template <typename T> void append_value(std::string &out, T value) {
+  out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+template <typename T> bool read_value(std::string_view &in, T &value) {
+  if (in.size() < sizeof(value)) {
+    return false;
+  }
+  std::memcpy(&value, in.data(), sizeof(value));
+  in.remove_prefix(sizeof(value));
+  return true;
+}
+
+std::filesystem::path cache_directory() {
+  if (const char *xdg_cache_home = getenv("XDG_CACHE_HOME");
+      xdg_cache_home && xdg_cache_home[0] != '\0') {
+    return std::filesystem::path(xdg_cache_home) / "hypergrep";
+  }
+  if (const char *home = getenv("HOME"); home && home[0] != '\0') {
+    return std::filesystem::path(home) / ".cache" / "hypergrep";
+  }
+  return {};
+}
+
+} // namespace
+
+listing_cache::listing_cache(const std::filesystem::path &root_path) {
+  std::error_code error;
+  auto absolute_root = std::filesystem::weakly_canonical(root_path, error);
+  if (error) {
+    absolute_root = std::filesystem::absolute(root_path, error);
+  }
+  root = absolute_root.native();
+
+  const auto directory = cache_directory();
+  if (directory.empty()) {
+    return;
+  }
+  file = directory / fmt::format("listings-{:016x}", fnv1a(root));
+
+  int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return;
+  }
+  struct stat sb;
+  if (fstat(fd, &sb) == 0 && sb.st_size > 0) {
+    contents.resize(sb.st_size);
+    std::size_t total{0};
+    while (total < contents.size()) {
+      auto ret = read(fd, contents.data() + total, contents.size() - total);
+      if (ret <= 0) {
+        break;
+      }
+      total += ret;
+    }
+    contents.resize(total);
+  }
+  close(fd);
+
+  // A cache file that doesn't belong to this root (or is truncated)
+  // is as good as none
+  std::string_view in(contents);
+  std::uint32_t root_length{0};
+  if (in.substr(0, MAGIC.size()) != MAGIC) {
+    return;
+  }
+  in.remove_prefix(MAGIC.size());
+  if (!read_value(in, root_length) || in.substr(0, root_length) != root) {
+    return;
+  }
+  in.remove_prefix(root_length);
+
+  while (in.size() >= RECORD_HEADER_SIZE) {
+    listing l{};
+    std::uint32_t path_length{0};
+    std::uint32_t entries_length{0};
+    read_value(in, l.device);
+    read_value(in, l.inode);
+    read_value(in, l.mtime_sec);
+    read_value(in, l.mtime_nsec);
+    read_value(in, l.ctime_sec);
+    read_value(in, l.ctime_nsec);
+    read_value(in, path_length);
+    read_value(in, entries_length);
+    if (in.size() < static_cast<std::size_t>(path_length) + entries_length) {
+      listings.clear();
+      return;
+    }
+    const auto path = in.substr(0, path_length);
+    l.entries = in.substr(path_length, entries_length);
+    in.remove_prefix(path_length + entries_length);
+    listings[path] = l;
+  }
+}
+
+listing_cache::listing listing_cache::make_listing(const struct stat &sb) {
+  listing l{};
+  l.device = sb.st_dev;
+  l.inode = sb.st_ino;
+  l.mtime_sec = sb.st_mtim.tv_sec;
+  l.mtime_nsec = sb.st_mtim.tv_nsec;
+  l.ctime_sec = sb.st_ctim.tv_sec;
+  l.ctime_nsec = sb.st_ctim.tv_nsec;
+  return l;
+}
+
+bool listing_cache::find(std::string_view directory, const struct stat &sb,
+                         std::string_view &entries) const {
+  auto it = listings.find(directory);
+  if (it == listings.end()) {
+    return false;
+  }
+
+  const auto current = make_listing(sb);
+  const auto &l = it->second;
+  if (l.device != current.device || l.inode != current.inode ||
+      l.mtime_sec != current.mtime_sec || l.mtime_nsec != current.mtime_nsec ||
+      l.ctime_sec != current.ctime_sec || l.ctime_nsec != current.ctime_nsec) {
+    return false;
+  }
+  entries = l.entries;
+  return true;
+}
+
+void listing_cache::store(std::string_view directory, const struct stat &sb,
+                          std::string_view entries) {
+  if (file.empty()) {
+    return;
+  }
+
+  const auto now = static_cast<std::int64_t>(time(nullptr));
+  if (sb.st_mtim.tv_sec + RACY_INTERVAL_SECONDS > now ||
+      sb.st_ctim.tv_sec + RACY_INTERVAL_SECONDS > now) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  stored.insert_or_assign(std::string(directory),
+                          std::make_pair(make_listing(sb), std::string(entries)));
+}
+
+void listing_cache::save() {
+  if (stored.empty()) {
+    return;
+  }
+
+  std::string out{};
+  out += MAGIC;
+  append_value(out, static_cast<std::uint32_t>(root.size()));
+  out += root;
+
+  const auto append_record = [&out](std::string_view path, const listing &l,
+                                    std::string_view entries) {
+    append_value(out, l.device);
+    append_value(out, l.inode);
+    append_value(out, l.mtime_sec);
+    append_value(out, l.mtime_nsec);
+    append_value(out, l.ctime_sec);
+    append_value(out, l.ctime_nsec);
+    append_value(out, static_cast<std::uint32_t>(path.size()));
+    append_value(out, static_cast<std::uint32_t>(entries.size()));
+    out += path;
+    out += entries;
+  };
+
+  // Listings of directories that weren't read again are kept as they are,
+  // they are validated the next time they are used
+  std::unordered_map<std::string_view, std::pair<const listing *,
+                                                 std::string_view>>
+      records{};
+  for (const auto &[path, l] : listings) {
+    records[path] = {&l, l.entries};
+  }
+  for (const auto &[path, value] : stored) {
+    records[path] = {&value.first, value.second};
+  }
+
+  // Unless the directory is gone: once its parent is read again, a
+  // directory that was removed or renamed is no longer in the parent's
+  // listing. Its record is dropped, and so are those below it. A record
+  // whose parent has none is kept.
+  std::unordered_map<std::string_view, bool> kept{};
+  std::unordered_map<std::string_view, std::unordered_set<std::string_view>>
+      names{};
+  const std::function<bool(std::string_view)> is_kept =
+      [&](std::string_view path) {
+        if (path.empty()) {
+          return true;
+        }
+        if (auto it = kept.find(path); it != kept.end()) {
+          return it->second;
+        }
+        const auto slash = path.rfind('/');
+        const auto parent = slash == std::string_view::npos
+                                ? std::string_view{}
+                                : path.substr(0, slash);
+        const auto name = path.substr(slash + 1);
+
+        bool result{true};
+        if (auto it = records.find(parent); it != records.end()) {
+          auto [parent_names, inserted] = names.try_emplace(parent);
+          if (inserted) {
+            cached_listing_reader reader(it->second.second);
+            directory_entry entry{};
+            while (reader.next(entry)) {
+              parent_names->second.insert(entry.name);
+            }
+          }
+          result = parent_names->second.count(name) > 0 && is_kept(parent);
+        }
+        kept[path] = result;
+        return result;
+      };
+
+  for (const auto &[path, record] : records) {
+    if (is_kept(path)) {
+      append_record(path, *record.first, record.second);
+    }
+  }
+
+  // Write a new file and rename it over the old one, so that concurrent
+  // searches never see a partial cache
+  std::error_code error;
+  std::filesystem::create_directories(file.parent_path(), error);
+  const auto temporary = file.native() + fmt::format(".{}", getpid());
+  int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                0644);
+  if (fd == -1) {
+    fprintf(stderr, "%s: Error writing listing cache: %s\n", temporary.c_str(),
+            strerror(errno));
+    return;
+  }
+
+  std::size_t total{0};
+  while (total < out.size()) {
+    auto ret = write(fd, out.data() + total, out.size() - total);
+    if (ret <= 0) {
+      break;
+    }
+    total += ret;
+  }
+  close(fd);
+
+  if (total != out.size() || rename(temporary.c_str(), file.c_str()) != 0) {
+    fprintf(stderr, "%s: Error writing listing cache: %s\n", file.c_str(),
+            strerror(errno));
+    unlink(temporary.c_str());
+  }
+}
+
+std::size_t listing_cache::append_entry(std::string &entries,
+                                        const directory_entry &entry) {
+  const auto type_offset = entries.size();
+  entries += static_cast<char>(entry.type);
+  append_value(entries, entry.inode);
+  entries += entry.name;
+  entries += '\0';
+  return type_offset;
+}
+
+cached_listing_reader::cached_listing_reader(std::string_view entries)
+    : entries(entries) {}
+
+bool cached_listing_reader::next(directory_entry &entry) {
+  if (entries.size() < 1 + sizeof(entry.inode)) {
+    return false;
+  }
+  entry.type = static_cast<unsigned char>(entries[0]);
+  entries.remove_prefix(1);
+  read_value(entries, entry.inode);
+
+  const auto end = entries.find('\0');
+  if (end == std::string_view::npos) {
+    return false;
+  }
+  entry.name = entries.data();
+  entries.remove_prefix(end + 1);
+  return true;
+}
@@ -3,6 +3,7 @@
 #include <hypergrep/file_search.hpp>
 #include <hypergrep/git_index_search.hpp>
 #include <hypergrep/print_help.hpp>
+#include <hypergrep/resource_governor.hpp>
 
 void perform_search(std::string &pattern, std::string_view path,
                     argparse::ArgumentParser &program) {
@@ -10,16 +11,7 @@ void perform_search(std::string &pattern, std::string_view path,
     // Program was called from a pipe
 
     file_search s(pattern, program);
-    std::string line;
-    std::size_t current_line_number{1};
-    while (std::getline(std::cin, line)) {
-      // Process line here
-      bool break_loop{false};
-      s.scan_line(line, current_line_number, break_loop);
-      if (break_loop) {
-        break;
-      }
-    }
+    s.run_stdin();
   } else {
     if (std::filesystem::is_regular_file(path)) {
       static file_search s(pattern, program);
@@ -37,7 +29,7 @@ void perform_search(std::string &pattern, std::string_view path,
 
         if (std::filesystem::exists(std::filesystem::path(path) / ".git")) {
           if (chdir(path.data()) == 0) {
-            static git_index_search s(pattern, current_path, program);
+            static git_index_search s(pattern, current_path, path, program);
             s.run(".");
             if (chdir(current_path.c_str()) != 0) {
               throw std::runtime_error("Failed to restore path");
@@ -52,6 +44,25 @@ void perform_search(std::string &pattern, std::string_view path,
   }
 }
 
+void search_file_list(std::string &pattern, const std::string &source,
+                      argparse::ArgumentParser &program) {
+  int fd = STDIN_FILENO;
+  if (source != "-") {
+    fd = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+      const auto error = fmt::format("Error: Unable to open file {}", source);
+      throw std::runtime_error(error.c_str());
+    }
+  }
+
+  directory_search s(pattern, ".", program);
+  s.run_file_list(fd);
+
+  if (fd != STDIN_FILENO) {
+    close(fd);
+  }
+}
+
 int main(int argc, char **argv) {
 
   argparse::ArgumentParser program("hg", VERSION.data(),
@@ -79,20 +90,32 @@ int main(int argc, char **argv) {
       .default_value(false)
       .implicit_value(true);
 
+  program.add_argument("--cpu-limit").scan<'g', double>();
+
   program.add_argument("-e", "--regexp")
       .default_value<std::vector<std::string>>({})
       .append();
 
+  program.add_argument("--exclude-dir")
+      .default_value<std::vector<std::string>>({})
+      .append();
+
   program.add_argument("-f", "--file").append();
 
   program.add_argument("--files").default_value(false).implicit_value(true);
 
+  program.add_argument("--files-from");
+
   program.add_argument("--filter");
 
   program.add_argument("-F", "--fixed-strings")
       .default_value(false)
       .implicit_value(true);
 
+  program.add_argument("-g", "--glob")
+      .default_value<std::vector<std::string>>({})
+      .append();
+
   program.add_argument("--hidden").default_value(false).implicit_value(true);
 
   program.add_argument("-i", "--ignore-case")
@@ -111,18 +134,46 @@ int main(int argc, char **argv) {
       .default_value(false)
       .implicit_value(true);
 
+  program.add_argument("--iglob")
+      .default_value<std::vector<std::string>>({})
+      .append();
+
+  program.add_argument("--io-concurrency");
+
+  program.add_argument("--io-depth").scan<'d', std::size_t>();
+
+  program.add_argument("--io-limit");
+
+  program.add_argument("--ioprio");
+
+  program.add_argument("--no-cache")
+      .default_value(false)
+      .implicit_value(true);
+
   program.add_argument("-I", "--no-filename")
       .default_value(false)
       .implicit_value(true);
 
+  program.add_argument("-L", "--follow")
+      .default_value(false)
+      .implicit_value(true);
+
   program.add_argument("-l", "--files-with-matches")
       .default_value(false)
       .implicit_value(true);
 
+  program.add_argument("--listing-cache")
+      .default_value(false)
+      .implicit_value(true);
+
   program.add_argument("-M", "--max-columns").scan<'d', std::size_t>();
 
+  program.add_argument("--max-depth").scan<'d', std::size_t>();
+
   program.add_argument("--max-filesize");
 
+  program.add_argument("--max-memory");
+
   program.add_argument("-n", "--line-number")
       .default_value(false)
       .implicit_value(true);
@@ -131,10 +182,42 @@ int main(int argc, char **argv) {
       .default_value(false)
       .implicit_value(true);
 
+  program.add_argument("--no-ignore")
+      .default_value(false)
+      .implicit_value(true);
+
+  program.add_argument("--one-file-system")
+      .default_value(false)
+      .implicit_value(true);
+
   program.add_argument("-o", "--only-matching")
       .default_value(false)
       .implicit_value(true);
 
+  program.add_argument("--report-aliases")
+      .default_value(false)
+      .implicit_value(true);
+
+  program.add_argument("--shard");
+
+  program.add_argument("--sort-files");
+
+  program.add_argument("-t", "--type")
+      .default_value<std::vector<std::string>>({})
+      .append();
+
+  program.add_argument("-T", "--type-not")
+      .default_value<std::vector<std::string>>({})
+      .append();
+
+  program.add_argument("--type-add")
+      .default_value<std::vector<std::string>>({})
+      .append();
+
+  program.add_argument("--type-list")
+      .default_value(false)
+      .implicit_value(true);
+
   program.add_argument("--trim").default_value(false).implicit_value(true);
 
   program.add_argument("--ucp").default_value(false).implicit_value(true);
@@ -169,6 +252,14 @@ int main(int argc, char **argv) {
   } else if (program.is_used("-v")) {
     fmt::print("{}\n", VERSION);
     return 0;
+  } else if (program.get<bool>("--type-list")) {
+    print_file_types(program.get<std::vector<std::string>>("--type-add"));
+    return 0;
+  }
+
+  // Before any search threads are started, so that they inherit it
+  if (program.is_used("--ioprio")) {
+    set_io_priority(program.get<std::string>("--ioprio"));
   }
 
   // If -f,--files,--regexp is NOT used,
@@ -177,6 +268,29 @@ int main(int argc, char **argv) {
   const auto files_used = program.get<bool>("--files");
   const auto regexp_used = program.is_used("-e");
 
+  // With --files-from, the list replaces the paths
+  const auto files_from_used = program.is_used("--files-from");
+  const auto search_paths = [&](std::string &pattern,
+                                const std::vector<std::string> &paths,
+                                std::size_t first_path) {
+    if (files_from_used) {
+      if (paths.size() > first_path) {
+        std::cerr << "Paths cannot be combined with --files-from\n";
+        return false;
+      }
+      search_file_list(pattern, program.get<std::string>("--files-from"),
+                       program);
+    } else if (paths.size() == first_path) {
+      // Default to current directory
+      perform_search(pattern, ".", program);
+    } else {
+      for (std::size_t i = first_path; i < paths.size(); ++i) {
+        perform_search(pattern, paths[i], program);
+      }
+    }
+    return true;
+  };
+
   if (pattern_file_provided || files_used || regexp_used) {
     // Treat everything in patterns_and_paths
     // as a list of paths
@@ -184,12 +298,8 @@ int main(int argc, char **argv) {
     // If empty, just search "."
     auto empty_pattern = std::string{};
     auto paths = program.get<std::vector<std::string>>("patterns_and_paths");
-    if (paths.empty()) {
-      perform_search(empty_pattern, ".", program);
-    } else {
-      for (const auto &path : paths) {
-        perform_search(empty_pattern, path, program);
-      }
+    if (!search_paths(empty_pattern, paths, 0)) {
+      return 1;
     }
   } else {
     // Treat first in patterns_and_paths
@@ -210,16 +320,13 @@ int main(int argc, char **argv) {
     }
 
     auto &pattern = patterns_and_paths[0];
-
-    if (size == 1) {
-      // Path not provided
-      // Default to current directory
-      perform_search(pattern, ".", program);
-    } else {
-      for (std::size_t i = 1; i < patterns_and_paths.size(); ++i) {
-        perform_search(pattern, patterns_and_paths[i], program);
-      }
+    if (!search_paths(pattern, patterns_and_paths, 1)) {
+      return 1;
     }
   }
+
+  if (const auto governor = shared_resource_governor(program)) {
+    governor->print_report();
+  }
   return 0;
 }
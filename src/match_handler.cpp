@@ -16,8 +16,87 @@ int on_match(unsigned int, unsigned long long from, unsigned long long to,
   }
 }
 
+hs_error_t scan_chunk(hs_stream_t *stream, hs_scratch_t *scratch,
+                      std::string_view chunk, std::size_t chunk_offset,
+                      bool last_chunk, file_context &ctx) {
+  auto result = hs_scan_stream(stream, chunk.data(), chunk.size(), 0, scratch,
+                               on_match, &ctx);
+  if (result == HS_SUCCESS && last_chunk) {
+    result = hs_reset_stream(stream, 0, scratch, on_match, &ctx);
+  }
+
+  // A match may start in an earlier chunk, it is shown from this one
+  for (auto &[from, to] : ctx.matches) {
+    from = std::max<unsigned long long>(from, chunk_offset) - chunk_offset;
+    to -= chunk_offset;
+  }
+  return result;
+}
+
+void long_line_matches::add_piece(std::string_view piece,
+                                  std::size_t piece_line_number,
+                                  std::size_t number_of_matches_in_piece) {
+  if (!in_line) {
+    // The first piece may start with the newline before the line
+    in_line = true;
+    line_number = piece_line_number +
+                  std::count(piece.begin(), piece.end(), '\n');
+  }
+  number_of_matches += number_of_matches_in_piece;
+}
+
+std::size_t long_line_matches::finish(std::string &lines, const char *filename,
+                                      bool print_filename, bool is_stdout,
+                                      bool show_line_numbers) {
+  const bool matched = number_of_matches > 0;
+  if (matched) {
+    append_omitted_line(lines, filename, line_number, number_of_matches,
+                        print_filename, is_stdout, show_line_numbers);
+  }
+  in_line = false;
+  number_of_matches = 0;
+  return matched ? 1 : 0;
+}
+
+void append_omitted_line(std::string &lines, const char *filename,
+                         std::size_t line_number,
+                         std::size_t number_of_matches, bool print_filename,
+                         bool is_stdout, bool show_line_numbers) {
+  // with line number: [Omitted long line with 2 matches]
+  // without line number: [Omitted long matching line]
+  if (show_line_numbers) {
+    if (is_stdout) {
+      lines += fmt::format(fg(fmt::color::green), "{}:", line_number);
+      lines += fmt::format("[Omitted long line with {} matches]\n",
+                           number_of_matches);
+    } else {
+
+      if (print_filename) {
+        lines += fmt::format("{}:{}:[Omitted long line with {} matches]\n",
+                             filename, line_number, number_of_matches);
+      } else {
+        lines += fmt::format("{}:[Omitted long line with {} matches]\n",
+                             line_number, number_of_matches);
+      }
+    }
+  } else {
+    if (is_stdout) {
+      lines += fmt::format("[Omitted long line with {} matches]\n",
+                           number_of_matches);
+    } else {
+      if (print_filename) {
+        lines += fmt::format("{}:[Omitted long line with {} matches]\n",
+                             filename, number_of_matches);
+      } else {
+        lines += fmt::format("[Omitted long line with {} matches]\n",
+                             number_of_matches);
+      }
+    }
+  }
+}
+
 std::size_t process_matches(
-    const char *filename, char *buffer, std::size_t bytes_read,
+    const char *filename, const char *buffer, std::size_t bytes_read,
     std::vector<std::pair<unsigned long long, unsigned long long>> &matches,
     std::size_t &current_line_number, std::string &lines, bool print_filename,
     bool is_stdout, bool show_line_numbers, bool show_column_numbers,
@@ -31,7 +110,7 @@ std::size_t process_matches(
   std::map<std::size_t, std::vector<std::pair<std::size_t, std::size_t>>>
       line_number_match;
   {
-    char *index = buffer;
+    const char *index = buffer;
     std::size_t previous_line_number = current_line_number;
     for (auto &match : matches) {
 
@@ -119,39 +198,9 @@ std::size_t process_matches(
       static std::size_t column_limit =
           apply_column_limit ? max_column_limit.value() : MAX_LINE_LENGTH;
       if (line_length > column_limit) {
-        // with line number: [Omitted long line with 2 matches]
-        // without line number: [Omitted long matching line]
-        if (show_line_numbers) {
-          if (is_stdout) {
-            lines +=
-                fmt::format(fg(fmt::color::green), "{}:", current_line_number);
-            lines += fmt::format("[Omitted long line with {} matches]\n",
-                                 matches.size());
-          } else {
-
-            if (print_filename) {
-              lines +=
-                  fmt::format("{}:{}:[Omitted long line with {} matches]\n",
-                              filename, current_line_number, matches.size());
-            } else {
-              lines += fmt::format("{}:[Omitted long line with {} matches]\n",
-                                   current_line_number, matches.size());
-            }
-          }
-        } else {
-          if (is_stdout) {
-            lines += fmt::format("[Omitted long line with {} matches]\n",
-                                 matches.size());
-          } else {
-            if (print_filename) {
-              lines += fmt::format("{}:[Omitted long line with {} matches]\n",
-                                   filename, matches.size());
-            } else {
-              lines += fmt::format("[Omitted long line with {} matches]\n",
-                                   matches.size());
-            }
-          }
-        }
+        append_omitted_line(lines, filename, current_line_number,
+                            matches.size(), print_filename, is_stdout,
+                            show_line_numbers);
         line_too_long = true;
         break;
       }
@@ -238,7 +287,7 @@ std::size_t process_matches(
 // and assumes that HS_FLAG_SOM_LEFTMOST is not used
 // when compiling the HyperScan database
 std::size_t process_matches_nocolor_nostdout(
-    const char *filename, char *buffer, std::size_t bytes_read,
+    const char *filename, const char *buffer, std::size_t bytes_read,
     std::vector<std::pair<unsigned long long, unsigned long long>> &matches,
     std::size_t &current_line_number, std::string &lines, bool print_filename,
     bool, bool show_line_numbers, bool, bool, bool,
@@ -254,7 +303,7 @@ std::size_t process_matches_nocolor_nostdout(
   // }
   std::map<std::size_t, std::pair<std::size_t, std::size_t>> line_number_match;
   {
-    char *index = buffer;
+    const char *index = buffer;
     std::size_t previous_line_number = current_line_number;
     for (auto &match : matches) {
 
@@ -307,26 +356,9 @@ std::size_t process_matches_nocolor_nostdout(
     static std::size_t column_limit =
         apply_column_limit ? max_column_limit.value() : MAX_LINE_LENGTH;
     if (line_length > column_limit) {
-      // with line number: [Omitted long line with 2 matches]
-      // without line number: [Omitted long matching line]
-      if (show_line_numbers) {
-        if (print_filename) {
-          lines +=
-              fmt::format("{}:{}:[Omitted long line with {} matches]\n",
-                          filename, current_line_number, number_of_matches);
-        } else {
-          lines += fmt::format("{}:[Omitted long line with {} matches]\n",
-                               current_line_number, number_of_matches);
-        }
-      } else {
-        if (print_filename) {
-          lines += fmt::format("{}:[Omitted long line with {} matches]\n",
-                               filename, number_of_matches);
-        } else {
-          lines += fmt::format("[Omitted long line with {} matches]\n",
-                               number_of_matches);
-        }
-      }
+      append_omitted_line(lines, filename, current_line_number,
+                          number_of_matches, print_filename, false,
+                          show_line_numbers);
       continue;
     }
 
@@ -0,0 +1,99 @@
+#include <cstring>
+#include <hypergrep/path_arena.hpp>
+#include <new>
+
+namespace {
+
+constexpr std::size_t align_up(std::size_t size) {
+  constexpr auto alignment = alignof(std::max_align_t);
+  return (size + alignment - 1) & ~(alignment - 1);
+}
+
+void append_name(const char *name, std::size_t name_length,
+                 std::string &out) {
+  if (!out.empty() && out.back() != '/') {
+    out += '/';
+  }
+  out.append(name, name_length);
+}
+
+} // namespace
+
+directory_node *path_arena::make_directory(directory_node *parent,
+                                           std::string_view name) {
+  const auto size = align_up(sizeof(directory_node) + name.size() + 1);
+
+  // Names are at most NAME_MAX (or PATH_MAX for a root) bytes long
+  // so a record always fits in a block
+  if (size > remaining) {
+    if (num_blocks == blocks.size()) {
+      blocks.push_back(std::make_unique<char[]>(BLOCK_SIZE));
+    }
+    cursor = blocks[num_blocks].get();
+    remaining = BLOCK_SIZE;
+    num_blocks += 1;
+  }
+
+  auto node = new (cursor) directory_node{};
+  node->parent = parent;
+  node->depth = parent ? parent->depth + 1 : 0;
+  node->name_length = name.size();
+  auto node_name = reinterpret_cast<char *>(node + 1);
+  std::memcpy(node_name, name.data(), name.size());
+  node_name[name.size()] = '\0';
+
+  cursor += size;
+  remaining -= size;
+  return node;
+}
+
+void path_arena::reset() {
+  // Keep the standard sized blocks around for the next search
+  num_blocks = 0;
+  cursor = nullptr;
+  remaining = 0;
+}
+
+char *make_file_block(directory_node *parent, const std::string &names,
+                      const std::vector<std::uint32_t> &offsets,
+                      std::vector<file_node *> &nodes) {
+  nodes.clear();
+  if (offsets.empty()) {
+    return nullptr;
+  }
+
+  std::size_t total_size{0};
+  for (const auto &offset : offsets) {
+    total_size += align_up(sizeof(file_node) + strlen(&names[offset]) + 1);
+  }
+
+  char *block = new char[total_size];
+  char *cursor = block;
+  for (const auto &offset : offsets) {
+    const char *name = &names[offset];
+    const auto name_length = strlen(name);
+
+    auto node = new (cursor) file_node{};
+    node->parent = parent;
+    node->name_length = name_length;
+    std::memcpy(reinterpret_cast<char *>(node + 1), name, name_length + 1);
+    nodes.push_back(node);
+
+    cursor += align_up(sizeof(file_node) + name_length + 1);
+  }
+
+  return block;
+}
+
+void append_path(const directory_node *directory, std::string &out) {
+  if (!directory) {
+    return;
+  }
+  append_path(directory->parent, out);
+  append_name(directory->name(), directory->name_length, out);
+}
+
+void append_path(const file_node *file, std::string &out) {
+  append_path(file->parent, out);
+  append_name(file->name(), file->name_length, out);
+}
@@ -114,6 +114,16 @@ void print_help() {
   print_description_line(
       "individual matches of the given pattern for each file searched\n");
 
+  // CPU budget
+  print_option_name(is_stdout, "--cpu-limit", "<CORES>");
+  print_description_line(
+      "Keep the CPU time used at or below <CORES> (e.g., 0.5 or 2) times");
+  print_description_line(
+      "the time elapsed. Search threads pause while over budget, but not");
+  print_description_line(
+      "while they wait on the disk. The CPU and I/O used are printed to");
+  print_description_line("stderr when the search is done.\n");
+
   // Pattern argument
   print_option_name(is_stdout, "-e, --regexp", "<PATTERN>...");
   print_description_line(
@@ -126,6 +136,17 @@ void print_help() {
   print_description_line(
       "will search for any occurrence of either of the patterns.\n");
 
+  // Exclude directories
+  print_option_name(is_stdout, "--exclude-dir", "<DIR_PATTERN>...");
+  print_description_line(
+      "Skip any directory whose path matches this regex pattern, e.g.,\n");
+  print_option_name(is_stdout,
+                    "        hgrep --exclude-dir '/(build|node_modules)$'\n");
+  print_description_line(
+      "Excluded directories are never opened, so nothing under them is");
+  print_description_line(
+      "traversed. This option can be provided multiple times.\n");
+
   // Pattern file
   print_option_name(is_stdout, "-f, --file", "<PATTERNFILE>...");
   print_description_line(
@@ -141,6 +162,15 @@ void print_help() {
       "Print each file that would be searched without actually");
   print_description_line("performing the search\n");
 
+  // Files from
+  print_option_name(is_stdout, "--files-from", "<FILE>");
+  print_description_line(
+      "Search the paths listed in <FILE> (or stdin, with -), separated by");
+  print_description_line(
+      "newlines or NUL bytes, instead of traversing directories. --type,");
+  print_description_line(
+      "--glob and --filter still apply. No other paths may be given.\n");
+
   // Filter
   print_option_name(is_stdout, "--filter", "<FILTER_PATTERN>");
   print_description_line("Filter paths based on a regex pattern, e.g.,\n");
@@ -165,7 +195,17 @@ void print_help() {
   print_option_name(is_stdout, "-h, --help");
   print_description_line("Display this help message.\n");
 
-  // Hidden
+  // Glob
+  print_option_name(is_stdout, "-g, --glob", "<GLOB>...");
+  print_description_line(
+      "Include or exclude (with a leading '!') files and directories whose");
+  print_description_line(
+      "path relative to the search root matches this glob. The last matching");
+  print_description_line(
+      "glob wins. This option can be provided multiple times, e.g.,\n");
+  print_option_name(is_stdout,
+                    "        hgrep -g '*.cc' -g '*.h' -g '!third_party/'\n");
+
   print_option_name(is_stdout, "--hidden");
   print_description_line(
       "Search hidden files and directories. By default, hidden files");
@@ -204,6 +244,12 @@ void print_help() {
       "For any detected git repository, this option will cause");
   print_description_line("hypergrep to exclude any submodules found.\n");
 
+  // Case insensitive glob
+  print_option_name(is_stdout, "--iglob", "<GLOB>...");
+  print_description_line(
+      "Same as --glob, but matches case insensitively. These globs are");
+  print_description_line("applied after any --glob.\n");
+
   // Include zero matches
   print_option_name(is_stdout, "--include-zero");
   print_description_line(
@@ -212,17 +258,74 @@ void print_help() {
       "matches for each file even if there were zero matches. This is");
   print_description_line("distabled by default.\n");
 
+  // Reads in flight per device class
+  print_option_name(is_stdout, "--io-concurrency", "<CLASS=NUM,...>");
+  print_description_line(
+      "Limit the reads in flight on each class of device: local, rotational");
+  print_description_line(
+      "(disks) or network (NFS, SMB, FUSE, ...), e.g., network=4. 0 means");
+  print_description_line(
+      "no limit. The defaults are local=0, rotational=2 and network=8.\n");
+
+  // io_uring
+  print_option_name(is_stdout, "--io-depth", "<NUM>");
+  print_description_line(
+      "When searching a git repository, keep up to <NUM> files per thread");
+  print_description_line(
+      "being opened and read through io_uring, and search whichever is");
+  print_description_line(
+      "read first. Blocking reads are used if io_uring is unavailable.");
+  print_description_line(
+      "Only the git index search uses it, directories outside a git");
+  print_description_line(
+      "repository are always read with blocking reads.\n");
+
+  // I/O bandwidth
+  print_option_name(is_stdout, "--io-limit", "<NUM+SUFFIX?>");
+  print_description_line(
+      "Read at most this many bytes per second, over all search threads,");
+  print_description_line(
+      "e.g., 50M. The input accepts suffixes of form K, M or G. The CPU");
+  print_description_line(
+      "and I/O used are printed to stderr when the search is done.\n");
+
+  // I/O priority
+  print_option_name(is_stdout, "--ioprio", "<idle|best-effort>");
+  print_description_line(
+      "Set the I/O scheduling class. With idle, files are only read when");
+  print_description_line(
+      "no other process is using the disk. best-effort uses the lowest");
+  print_description_line("priority of the default class.\n");
+
   // No filename
   print_option_name(is_stdout, "-I, --no-filename");
   print_description_line(
       "Never print the file path with the matched lines. This is the");
   print_description_line("default when searching one file or stdin.\n");
 
+  // Follow symlinks
+  print_option_name(is_stdout, "-L, --follow");
+  print_description_line(
+      "Follow symbolic links while traversing directories. Each file and");
+  print_description_line(
+      "directory is visited once, by (device, inode), so link cycles and");
+  print_description_line("bind mounts are not searched twice.\n");
+
   // Files with matches
   print_option_name(is_stdout, "-l, --files-with-matches");
   print_description_line(
       "Print the paths with at least one match and suppress match contents.\n");
 
+  // Listing cache
+  print_option_name(is_stdout, "--listing-cache");
+  print_description_line(
+      "Keep directory listings on disk between runs, validated by the");
+  print_description_line(
+      "mtime and ctime of each directory. Unchanged directories are listed");
+  print_description_line(
+      "from the cache without being opened. The cache is kept per search");
+  print_description_line("path under $XDG_CACHE_HOME/hypergrep.\n");
+
   // Max columns
   print_option_name(is_stdout, "-M, --max-columns", "<NUM>");
   print_description_line(
@@ -230,6 +333,14 @@ void print_help() {
   print_description_line(
       "omitted, and only the number of matches in that line is printed.\n");
 
+  // Max depth
+  print_option_name(is_stdout, "--max-depth", "<NUM>");
+  print_description_line(
+      "Limit the depth of directory traversal to <NUM> levels beyond the");
+  print_description_line(
+      "paths given. A value of 1 only searches the direct children of");
+  print_description_line("each path.\n");
+
   // Max filesize
   print_option_name(is_stdout, "--max-filesize", "<NUM+SUFFIX?>");
   print_description_line(
@@ -240,6 +351,18 @@ void print_help() {
   print_option_name(is_stdout, "        hgrep --max-filesize 50K\n");
   print_description_line("will search any files under 50KB in size.\n");
 
+  print_option_name(is_stdout, "--max-memory", "<NUM+SUFFIX?>");
+  print_description_line(
+      "Bound the memory held by the read buffers, the pending results of");
+  print_description_line(
+      "large files and their buffered output. Once the budget is used up,");
+  print_description_line(
+      "large file search stops running ahead of the printing and buffered");
+  print_description_line(
+      "output is printed early. Accepts the same suffixes as --max-filesize");
+  print_description_line("e.g.,\n");
+  print_option_name(is_stdout, "        hgrep --max-memory 256M foo\n");
+
   // Line Number
   print_option_name(is_stdout, "-n, --line-number");
   print_description_line("Show line numbers (1-based). This is enabled by "
@@ -252,12 +375,89 @@ void print_help() {
                          "when not searching in");
   print_description_line("a terminal.\n");
 
+  // No ignore files
+  print_option_name(is_stdout, "--no-ignore");
+  print_description_line(
+      "Outside of git repositories, hypergrep honors the rules in any");
+  print_description_line(
+      ".gitignore, .ignore and .hgignore files found during traversal.");
+  print_description_line("Using --no-ignore will disable this behavior.\n");
+
+  // No cache
+  print_option_name(is_stdout, "--no-cache");
+  print_description_line(
+      "Read files without filling the page cache, e.g., for a one-off");
+  print_description_line(
+      "search of a large tree that would evict everything else. Files are");
+  print_description_line(
+      "read with O_DIRECT where the filesystem supports it, otherwise the");
+  print_description_line("pages read are dropped again once searched.\n");
+
+  // One file system
+  print_option_name(is_stdout, "--one-file-system");
+  print_description_line(
+      "Do not descend into directories on other file systems (e.g., NFS");
+  print_description_line(
+      "or FUSE mounts) than the path being searched.\n");
+
   // Only matching parts
   print_option_name(is_stdout, "-o, --only-matching");
   print_description_line(
       "Print only matched parts of a matching line, with each such part on a");
   print_description_line("separate output line.\n");
 
+  // Report aliases
+  print_option_name(is_stdout, "--report-aliases");
+  print_description_line(
+      "Search each file once even if it is reachable through several paths");
+  print_description_line(
+      "(hard links, symbolic links or bind mounts), and after the search");
+  print_description_line(
+      "print every other path of a file with matches as 'alias -> path'.\n");
+
+  // Shard
+  print_option_name(is_stdout, "--shard", "<i/n>");
+  print_description_line(
+      "Only search shard i of n (1 <= i <= n). Files are assigned to a");
+  print_description_line(
+      "shard by a stable hash of their path relative to the search path,");
+  print_description_line(
+      "and the chunks of large files by path and chunk index, so n runs");
+  print_description_line(
+      "together search everything exactly once. Counts of a large file");
+  print_description_line("are split between the shards.\n");
+
+  // Sort files
+  print_option_name(is_stdout, "--sort-files", "<inode|extent>");
+  print_description_line(
+      "Read files in batches sorted by inode number or by the physical");
+  print_description_line(
+      "offset of their first extent (FIEMAP), with limited concurrency.");
+  print_description_line(
+      "This turns cold-cache searches on rotational disks into mostly");
+  print_description_line("sequential I/O.\n");
+
+  // File types
+  print_option_name(is_stdout, "-t, --type", "<TYPE>...");
+  print_description_line(
+      "Only search files of this type, e.g., cpp or py. This option can be");
+  print_description_line(
+      "provided multiple times. Use --type-list to see the known types.\n");
+
+  print_option_name(is_stdout, "-T, --type-not", "<TYPE>...");
+  print_description_line(
+      "Do not search files of this type. This option can be provided");
+  print_description_line("multiple times.\n");
+
+  print_option_name(is_stdout, "--type-add", "<TYPE_SPEC>...");
+  print_description_line(
+      "Add globs to a file type, or define a new one, e.g.,\n");
+  print_option_name(is_stdout,
+                    "        hgrep --type-add 'web:*.html,*.css' -t web\n");
+
+  print_option_name(is_stdout, "--type-list");
+  print_description_line("Show all known file types and their globs.\n");
+
   // UCP
   print_option_name(is_stdout, "--ucp");
   print_description_line(
@@ -0,0 +1,180 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fmt/format.h>
+#include <hypergrep/resource_governor.hpp>
+#include <hypergrep/size_to_bytes.hpp>
+#include <iostream>
+#include <stdexcept>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+// From linux/ioprio.h, which older kernel headers don't ship
+constexpr int IOPRIO_CLASS_SHIFT = 13;
+constexpr int IOPRIO_CLASS_BE = 2;
+constexpr int IOPRIO_CLASS_IDLE = 3;
+constexpr int IOPRIO_WHO_PROCESS = 1;
+// Lowest priority level within the best-effort class
+constexpr int IOPRIO_BE_LOWEST_LEVEL = 7;
+
+// Reads may run ahead of the I/O limit by this much
+constexpr std::int64_t IO_BURST_NS = 100'000'000;
+
+// How often a thread compares the CPU time of the process with the budget
+constexpr std::int64_t CPU_CHECK_INTERVAL_NS = 1'000'000;
+
+constexpr double NS_PER_SECOND = 1e9;
+constexpr double BYTES_PER_MIB = 1024.0 * 1024.0;
+
+std::int64_t process_cpu_ns() {
+  timespec ts{};
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return static_cast<std::int64_t>(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+}
+
+} // namespace
+
+resource_governor::resource_governor(
+    std::optional<std::size_t> io_bytes_per_second,
+    std::optional<double> cpu_cores)
+    : io_bytes_per_second(io_bytes_per_second), cpu_cores(cpu_cores),
+      start(clock::now()), start_cpu_ns(process_cpu_ns()) {}
+
+std::int64_t resource_governor::elapsed_ns() const {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() -
+                                                              start)
+      .count();
+}
+
+void resource_governor::pace(std::size_t bytes) {
+  bytes_read += bytes;
+  if (io_bytes_per_second) {
+    wait_for_io(bytes);
+  }
+  throttle_cpu();
+}
+
+void resource_governor::wait_for_io(std::size_t bytes) {
+  const auto cost_ns = static_cast<std::int64_t>(
+      static_cast<double>(bytes) * NS_PER_SECOND / *io_bytes_per_second);
+
+  // Take the bytes from the bucket, then wait until they have accrued
+  const auto now = elapsed_ns();
+  auto ready = io_ready_ns.load();
+  std::int64_t granted{0};
+  do {
+    granted = std::max(ready, now) + cost_ns;
+  } while (!io_ready_ns.compare_exchange_weak(ready, granted));
+
+  const auto wait_ns = granted - IO_BURST_NS - now;
+  if (wait_ns > 0) {
+    std::this_thread::sleep_for(std::chrono::nanoseconds(wait_ns));
+    io_wait_ns += wait_ns;
+  }
+}
+
+void resource_governor::throttle_cpu() {
+  if (!cpu_cores) {
+    return;
+  }
+
+  // Reading the CPU time of the process is a system call, so each thread
+  // checks at most once per interval
+  thread_local std::int64_t next_check_ns{0};
+  const auto now = elapsed_ns();
+  if (now < next_check_ns) {
+    return;
+  }
+  next_check_ns = now + CPU_CHECK_INTERVAL_NS;
+
+  // Once over budget, every worker that gets here pauses until the wall
+  // time has caught up with the CPU time used
+  const auto used_ns = process_cpu_ns() - start_cpu_ns;
+  const auto budget_ns = static_cast<std::int64_t>(*cpu_cores * now);
+  if (used_ns > budget_ns) {
+    const auto wait_ns =
+        static_cast<std::int64_t>((used_ns - budget_ns) / *cpu_cores);
+    std::this_thread::sleep_for(std::chrono::nanoseconds(wait_ns));
+    cpu_wait_ns += wait_ns;
+  }
+}
+
+void resource_governor::print_report() const {
+  const double seconds = elapsed_ns() / NS_PER_SECOND;
+  const double cpu_seconds =
+      (process_cpu_ns() - start_cpu_ns) / NS_PER_SECOND;
+  const double mib_read = bytes_read / BYTES_PER_MIB;
+
+  std::string report =
+      fmt::format("io: {:.1f} MiB read in {:.2f}s, {:.1f} MiB/s", mib_read,
+                  seconds, seconds > 0 ? mib_read / seconds : 0.0);
+  if (io_bytes_per_second) {
+    report += fmt::format(" (limit {:.1f} MiB/s), reads waited {:.2f}s",
+                          *io_bytes_per_second / BYTES_PER_MIB,
+                          io_wait_ns / NS_PER_SECOND);
+  }
+  report += fmt::format("\ncpu: {:.2f}s used in {:.2f}s, {:.2f} cores",
+                        cpu_seconds, seconds,
+                        seconds > 0 ? cpu_seconds / seconds : 0.0);
+  if (cpu_cores) {
+    report += fmt::format(" (limit {:.2f}), workers paused {:.2f}s",
+                          *cpu_cores, cpu_wait_ns / NS_PER_SECOND);
+  }
+  std::cerr << report << "\n";
+}
+
+void set_io_priority(std::string_view io_class) {
+  int priority{0};
+  if (io_class == "idle") {
+    priority = IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT;
+  } else if (io_class == "best-effort") {
+    priority =
+        (IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | IOPRIO_BE_LOWEST_LEVEL;
+  } else {
+    throw std::runtime_error("Invalid --ioprio '" + std::string(io_class) +
+                             "', expected idle or best-effort");
+  }
+
+  // Only lowers the priority, so this is not expected to fail. If it does,
+  // the search goes ahead as usual.
+  if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, priority) == -1) {
+    std::cerr << "--ioprio: " << std::strerror(errno) << " (os error "
+              << errno << ")\n";
+  }
+}
+
+std::shared_ptr<resource_governor>
+shared_resource_governor(argparse::ArgumentParser &program) {
+  static const auto governor =
+      [&program]() -> std::shared_ptr<resource_governor> {
+    std::optional<std::size_t> io_bytes_per_second{};
+    if (program.is_used("--io-limit")) {
+      io_bytes_per_second =
+          size_to_bytes(program.get<std::string>("--io-limit"));
+      if (*io_bytes_per_second == 0) {
+        throw std::runtime_error(
+            "Invalid --io-limit, expected a size above 0");
+      }
+    }
+
+    std::optional<double> cpu_cores{};
+    if (program.is_used("--cpu-limit")) {
+      cpu_cores = program.get<double>("--cpu-limit");
+      if (!(*cpu_cores > 0)) {
+        throw std::runtime_error(
+            "Invalid --cpu-limit, expected a number of cores above 0");
+      }
+    }
+
+    if (!io_bytes_per_second && !cpu_cores) {
+      return nullptr;
+    }
+    return std::make_shared<resource_governor>(io_bytes_per_second,
+                                               cpu_cores);
+  }();
+  return governor;
+}
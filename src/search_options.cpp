@@ -1,6 +1,9 @@
+#include <algorithm>
 #include <fstream>
+#include <string_view>
 #include <hypergrep/compiler.hpp>
 #include <hypergrep/search_options.hpp>
+#include <hypergrep/streaming_database.hpp>
 
 void read_pattern_file(const std::string &filename,
                        std::vector<std::string> &pattern_list) {
@@ -17,10 +20,62 @@ void read_pattern_file(const std::string &filename,
   }
 }
 
+namespace {
+
+// Whether the pattern anchors at the start or end of the data: an
+// unescaped ^ or $ outside a character class, or \A, \z or \Z. Escaped
+// characters, \Q...\E quotes and classes (e.g., [^a-z] or [$]) don't.
+bool has_anchor(std::string_view pattern) {
+  bool in_class{false};
+  for (std::size_t i = 0; i < pattern.size(); ++i) {
+    const char c = pattern[i];
+    if (c == '\\') {
+      if (i + 1 == pattern.size()) {
+        break;
+      }
+      const char next = pattern[++i];
+      if (next == 'Q') {
+        const auto end = pattern.find("\\E", i + 1);
+        if (end == std::string_view::npos) {
+          break;
+        }
+        i = end + 1;
+      } else if (!in_class && (next == 'A' || next == 'z' || next == 'Z')) {
+        return true;
+      }
+    } else if (in_class) {
+      if (c == '[' && i + 1 < pattern.size() && pattern[i + 1] == ':') {
+        // A POSIX class, e.g., [:alpha:]
+        const auto end = pattern.find(":]", i + 2);
+        if (end != std::string_view::npos) {
+          i = end + 1;
+        }
+      } else if (c == ']') {
+        in_class = false;
+      }
+    } else if (c == '[') {
+      // A ] right after [ or [^ is part of the class
+      in_class = true;
+      if (i + 1 < pattern.size() && pattern[i + 1] == '^') {
+        ++i;
+      }
+      if (i + 1 < pattern.size() && pattern[i + 1] == ']') {
+        ++i;
+      }
+    } else if (c == '^' || c == '$') {
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace
+
 void initialize_search(std::string &pattern, argparse::ArgumentParser &program,
                        search_options &options, hs_database **database,
                        hs_scratch **scratch, hs_database **file_filter_database,
-                       hs_scratch **file_filter_scratch) {
+                       hs_scratch **file_filter_scratch,
+                       streaming_database **stream_database) {
 
   options.count_matching_lines = program.get<bool>("-c");
   options.count_matches = program.get<bool>("--count-matches");
@@ -43,10 +98,76 @@ void initialize_search(std::string &pattern, argparse::ArgumentParser &program,
     }
   }
 
+  options.file_types = std::make_shared<file_type_filter>(
+      program.get<std::vector<std::string>>("-t"),
+      program.get<std::vector<std::string>>("-T"),
+      program.get<std::vector<std::string>>("--type-add"));
+
+  if (program.is_used("-g") || program.is_used("--iglob")) {
+    options.globs = std::make_shared<glob_filter>(
+        program.get<std::vector<std::string>>("-g"),
+        program.get<std::vector<std::string>>("--iglob"));
+  }
+
+  options.follow_symlinks = program.get<bool>("-L");
+  options.report_aliases = program.get<bool>("--report-aliases");
+  options.deduplicate_inodes =
+      options.follow_symlinks || options.report_aliases;
+
+  options.cache_listings = program.get<bool>("--listing-cache");
+
+  if (program.is_used("--shard")) {
+    options.shard = parse_shard(program.get<std::string>("--shard"));
+  }
+
+  if (program.is_used("--sort-files")) {
+    const auto order = program.get<std::string>("--sort-files");
+    if (order == "inode") {
+      options.read_order = file_read_order::inode;
+    } else if (order == "extent") {
+      options.read_order = file_read_order::extent;
+    } else {
+      throw std::runtime_error("Invalid --sort-files '" + order +
+                               "', expected inode or extent");
+    }
+  }
+
+  if (program.is_used("--io-depth")) {
+    options.io_depth = program.get<std::size_t>("--io-depth");
+  }
+
+  options.no_cache = program.get<bool>("--no-cache");
+  options.governor = shared_resource_governor(program);
+  options.device_limits = std::make_shared<io_concurrency>(
+      parse_io_concurrency(program.is_used("--io-concurrency")
+                               ? program.get<std::string>("--io-concurrency")
+                               : std::string{}));
+
+  options.exclude_directory_patterns =
+      program.get<std::vector<std::string>>("--exclude-dir");
+
+  if (program.is_used("--max-depth")) {
+    options.max_depth = program.get<std::size_t>("--max-depth");
+  }
+
+  options.one_file_system = program.get<bool>("--one-file-system");
+
+  options.respect_ignore_files = !program.get<bool>("--no-ignore");
+
   if (program.is_used("-M")) {
     options.max_column_limit = program.get<std::size_t>("-M");
   }
 
+  if (program.is_used("--max-memory")) {
+    const auto max_memory =
+        size_to_bytes(program.get<std::string>("--max-memory"));
+    if (max_memory == 0) {
+      throw std::runtime_error(
+          "Invalid --max-memory, expected a size above 0");
+    }
+    options.memory = std::make_shared<memory_budget>(max_memory);
+  }
+
   if (program.is_used("--max-filesize")) {
     const auto max_file_size_spec = program.get<std::string>("--max-filesize");
     options.max_file_size = size_to_bytes(max_file_size_spec);
@@ -111,9 +232,19 @@ void initialize_search(std::string &pattern, argparse::ArgumentParser &program,
     }
 
     if (pattern_list.empty()) {
-      compile_hs_database(database, scratch, options, {pattern});
-    } else {
-      compile_hs_database(database, scratch, options, pattern_list);
+      pattern_list.push_back(pattern);
+    }
+
+    // Without HS_FLAG_MULTILINE, ^ and $ match only at the ends of the data
+    options.batch_tiny_files =
+        !options.count_include_zeros &&
+        (options.compile_pattern_as_literal ||
+         std::none_of(pattern_list.begin(), pattern_list.end(),
+                      [](const std::string &p) { return has_anchor(p); }));
+
+    compile_hs_database(database, scratch, options, pattern_list);
+    if (stream_database) {
+      *stream_database = new streaming_database(options, pattern_list);
     }
   }
 }
\ No newline at end of file
@@ -0,0 +1,67 @@
+#include <charconv>
+#include <hypergrep/fnv1a.hpp>
+#include <hypergrep/shard.hpp>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+std::string_view strip_current_directory(std::string_view path) {
+  while (path.size() > 2 && path[0] == '.' && path[1] == '/') {
+    path.remove_prefix(2);
+  }
+  return path;
+}
+
+// FNV-1a alone leaves the low bits poorly mixed for similar paths,
+// so finish with the splitmix64 finalizer before taking the modulo
+std::uint64_t mix(std::uint64_t hash) {
+  hash ^= hash >> 30;
+  hash *= 0xbf58476d1ce4e5b9ull;
+  hash ^= hash >> 27;
+  hash *= 0x94d049bb133111ebull;
+  hash ^= hash >> 31;
+  return hash;
+}
+
+bool parse_number(std::string_view str, std::size_t &value) {
+  const auto end = str.data() + str.size();
+  const auto [ptr, error] = std::from_chars(str.data(), end, value);
+  return error == std::errc{} && ptr == end;
+}
+
+} // namespace
+
+shard_spec parse_shard(std::string_view spec) {
+  const auto slash = spec.find('/');
+  std::size_t index{0};
+  std::size_t count{0};
+  if (slash == std::string_view::npos ||
+      !parse_number(spec.substr(0, slash), index) ||
+      !parse_number(spec.substr(slash + 1), count) || index == 0 ||
+      index > count) {
+    throw std::runtime_error("Invalid --shard '" + std::string(spec) +
+                             "', expected i/n with 1 <= i <= n");
+  }
+  return shard_spec{index - 1, count};
+}
+
+bool in_shard(const shard_spec &shard, std::string_view path) {
+  return mix(fnv1a(strip_current_directory(path))) % shard.count ==
+         shard.index;
+}
+
+bool in_shard(const shard_spec &shard, std::string_view path,
+              std::size_t chunk_index) {
+  // Arithmetic rather than the bytes of the index, so that hosts of any
+  // endianness agree
+  const auto hash = fnv1a(strip_current_directory(path)) ^
+                    (static_cast<std::uint64_t>(chunk_index + 1) *
+                     0x9e3779b97f4a7c15ull);
+  return mix(hash) % shard.count == shard.index;
+}
+
+std::string inode_shard_key(std::uint64_t inode) {
+  // No path relative to the search root starts with "//"
+  return "//inode/" + std::to_string(inode);
+}
@@ -0,0 +1,78 @@
+#include <cstdio>
+#include <hypergrep/compiler.hpp>
+#include <hypergrep/match_handler.hpp>
+#include <hypergrep/streaming_database.hpp>
+#include <stdexcept>
+
+streaming_database::streaming_database(const search_options &options,
+                                       std::vector<std::string> pattern_list)
+    : options(options), pattern_list(std::move(pattern_list)) {}
+
+streaming_database::~streaming_database() {
+  if (database) {
+    hs_free_database(database);
+  }
+}
+
+hs_database_t *streaming_database::get() {
+  std::call_once(compiled, [this]() {
+    hs_scratch_t *scratch = NULL;
+    try {
+      compile_hs_database(&database, &scratch, options, pattern_list,
+                          HS_MODE_STREAM);
+    } catch (const std::runtime_error &error) {
+      fprintf(stderr,
+              "%s (streaming mode), files read in chunks are scanned "
+              "chunk by chunk instead\n",
+              error.what());
+      if (database) {
+        hs_free_database(database);
+        database = nullptr;
+      }
+    }
+    if (scratch) {
+      hs_free_scratch(scratch);
+    }
+  });
+  return database;
+}
+
+chunk_stream::chunk_stream(const hs_database_t *block_database,
+                           streaming_database *database)
+    : block_database(block_database), database(database) {}
+
+chunk_stream::~chunk_stream() {
+  if (stream) {
+    hs_close_stream(stream, scratch, NULL, NULL);
+  }
+  if (scratch) {
+    hs_free_scratch(scratch);
+  }
+}
+
+void chunk_stream::reset() {
+  if (!opened) {
+    opened = true;
+    if (auto stream_database = database ? database->get() : nullptr) {
+      if (hs_alloc_scratch(stream_database, &scratch) != HS_SUCCESS) {
+        throw std::runtime_error("Error allocating scratch space");
+      }
+      if (hs_open_stream(stream_database, 0, &stream) != HS_SUCCESS) {
+        throw std::runtime_error("Error opening stream");
+      }
+    }
+  } else if (stream) {
+    hs_reset_stream(stream, 0, scratch, NULL, NULL);
+  }
+}
+
+hs_error_t chunk_stream::scan(hs_scratch_t *block_scratch,
+                              std::string_view chunk, std::size_t chunk_offset,
+                              bool last_chunk, file_context &ctx) {
+  if (stream) {
+    return scan_chunk(stream, scratch, chunk, chunk_offset, last_chunk, ctx);
+  }
+  // Match offsets are relative to the chunk already
+  return hs_scan(block_database, chunk.data(), chunk.size(), 0,
+                 block_scratch, on_match, &ctx);
+}
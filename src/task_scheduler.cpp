@@ -0,0 +1,157 @@
+#include <hypergrep/task_scheduler.hpp>
+
+namespace {
+thread_local task_scheduler *current_scheduler{nullptr};
+thread_local std::size_t current_worker_index{0};
+} // namespace
+
+task_scheduler::task_scheduler(std::size_t num_workers) {
+  if (num_workers == 0) {
+    num_workers = 1;
+  }
+
+  queues.reserve(num_workers);
+  for (std::size_t i = 0; i < num_workers; ++i) {
+    queues.push_back(std::make_unique<worker_queue>());
+  }
+
+  workers.reserve(num_workers);
+  for (std::size_t i = 0; i < num_workers; ++i) {
+    workers.emplace_back(&task_scheduler::worker_function, this, i);
+  }
+}
+
+task_scheduler::~task_scheduler() {
+  wait();
+
+  {
+    std::lock_guard<std::mutex> lock(park_mutex);
+    stopping = true;
+  }
+  park_cv.notify_all();
+
+  for (auto &w : workers) {
+    w.join();
+  }
+}
+
+void task_scheduler::submit(task &&t) { push(std::move(t), false); }
+
+void task_scheduler::submit_leaf(task &&t) { push(std::move(t), true); }
+
+void task_scheduler::push(task &&t, bool leaf) {
+  // Count the task before it becomes visible so that neither wait()
+  // nor a parked worker can observe a stale zero
+  num_pending += 1;
+  num_queued += 1;
+
+  auto &q = (current_scheduler == this) ? *queues[current_worker_index]
+                                        : injection_queue;
+  {
+    std::lock_guard<std::mutex> lock(q.mutex);
+    (leaf ? q.leaf_tasks : q.tasks).push_back(std::move(t));
+  }
+
+  // A worker increments num_parked before re-checking num_queued, so
+  // either it sees the new task or this thread sees it parked
+  if (num_parked > 0) {
+    std::lock_guard<std::mutex> lock(park_mutex);
+    park_cv.notify_one();
+  }
+}
+
+bool task_scheduler::try_pop(std::size_t worker_index, task &t,
+                             bool leaf_only) {
+  // Leaf tasks first, they are what waiting tasks wait for
+  const auto pop = [this, &t, leaf_only](worker_queue &q, bool newest) {
+    std::lock_guard<std::mutex> lock(q.mutex);
+    for (auto tasks : {&q.leaf_tasks, &q.tasks}) {
+      if (tasks->empty()) {
+        if (leaf_only) {
+          return false;
+        }
+        continue;
+      }
+      if (newest) {
+        t = std::move(tasks->back());
+        tasks->pop_back();
+      } else {
+        t = std::move(tasks->front());
+        tasks->pop_front();
+      }
+      num_queued -= 1;
+      return true;
+    }
+    return false;
+  };
+
+  // Own deque first, newest task
+  if (pop(*queues[worker_index], true)) {
+    return true;
+  }
+
+  // Then anything submitted from outside the pool
+  if (pop(injection_queue, false)) {
+    return true;
+  }
+
+  // Then steal the oldest task from another worker
+  const auto n = queues.size();
+  for (std::size_t i = 1; i < n; ++i) {
+    if (pop(*queues[(worker_index + i) % n], false)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void task_scheduler::run_task(task &t, std::size_t worker_index) {
+  t(worker_index);
+  t = nullptr;
+
+  if (--num_pending == 0) {
+    std::lock_guard<std::mutex> lock(done_mutex);
+    done_cv.notify_all();
+  }
+}
+
+void task_scheduler::worker_function(std::size_t worker_index) {
+  current_scheduler = this;
+  current_worker_index = worker_index;
+
+  task t{};
+  while (true) {
+    if (try_pop(worker_index, t, false)) {
+      run_task(t, worker_index);
+      continue;
+    }
+
+    // Nothing to do, park until a task is submitted
+    std::unique_lock<std::mutex> lock(park_mutex);
+    num_parked += 1;
+    park_cv.wait(lock, [this]() { return stopping || num_queued > 0; });
+    num_parked -= 1;
+    if (stopping) {
+      break;
+    }
+  }
+}
+
+bool task_scheduler::try_run_pending_task() {
+  if (current_scheduler != this) {
+    return false;
+  }
+
+  task t{};
+  if (try_pop(current_worker_index, t, true)) {
+    run_task(t, current_worker_index);
+    return true;
+  }
+  return false;
+}
+
+void task_scheduler::wait() {
+  std::unique_lock<std::mutex> lock(done_mutex);
+  done_cv.wait(lock, [this]() { return num_pending == 0; });
+}